@@ -1,69 +1,105 @@
 #version 330
 
+// Variants are compiled by load_shader_variant; see ShaderFeature in render_pass.hpp.
+
 in vec2 TexCoord;
-in vec4 Position;
 
 uniform sampler2D Texture;
-uniform float BrightRadius;
-uniform float DimRadius;
-uniform bool FullBright;
-uniform bool EnableFisheye;
-uniform float FisheyeTheta;
 
 out vec3 OutColor;
 
+#ifdef FISHEYE
+uniform float FisheyeTheta;
+
 float xfov_to_yfov(float xfov, float aspect) {
     return 2.0f * atan(tan(xfov * 0.5f) / aspect);
 }
 
 vec2 fisheye(vec2 src)
 {
-    if (EnableFisheye) {
-        float z = sqrt(1.0 - src.x * src.x - src.y * src.y);
-        float t = tan(FisheyeTheta);
-        float a = 1.0 / (z * t);
-        vec2 c = 2.0 * vec2(0.5,0.5) / (sqrt(0.5) * t); // refit to corners
-        return (src * a / c);
-    }
-    return src;
+    float z = sqrt(1.0 - src.x * src.x - src.y * src.y);
+    float t = tan(FisheyeTheta);
+    float a = 1.0 / (z * t);
+    vec2 c = 2.0 * vec2(0.5,0.5) / (sqrt(0.5) * t); // refit to corners
+    return (src * a / c);
 }
 
 vec2 fisheye2(vec2 src)
 {
-    if (EnableFisheye) {
-        float b = (3.14159 - FisheyeTheta) / 2.0;
-        float y = tan(b);
-        float a = atan(y, src.x);
-        src.x = 2.0 * a / FisheyeTheta;
-    }
+    float b = (3.14159 - FisheyeTheta) / 2.0;
+    float y = tan(b);
+    float a = atan(y, src.x);
+    src.x = 2.0 * a / FisheyeTheta;
     return src;
 }
 
 vec2 fisheye3(vec2 src, vec2 fovs)
 {
-    if (EnableFisheye) {
-        vec2 b = (3.14159 - fovs) / 2.0;
-        vec2 y = tan(b);
-        vec2 a = src * fovs / 2.0;
-        src = y * tan(a);
-    }
+    vec2 b = (3.14159 - fovs) / 2.0;
+    vec2 y = tan(b);
+    vec2 a = src * fovs / 2.0;
+    src = y * tan(a);
     return src;
 }
+#endif
+
+#ifdef LIGHTING
+in vec4 Position;
+
+uniform float BrightRadius;
+uniform float DimRadius;
+
+// Clustered lights, see LightClusters in lighting.hpp.
+uniform samplerBuffer LightData;
+uniform usamplerBuffer LightGrid;
+uniform usamplerBuffer LightIndices;
+uniform vec4 ClusterParams;
+
+const int GRID_X = 16;
+const int GRID_Y = 8;
+const int GRID_Z = 24;
+
+float light_level(float dist, float bright, float dim) {
+    if (dist > dim) {
+        return 0.0;
+    } else if (dist > bright) {
+        return 0.30;
+    }
+    return 0.80;
+}
+
+int cluster_index(vec3 pos) {
+    float depth = -pos.z;
+    int z = 0;
+    if (depth > ClusterParams.z) {
+        z = min(1 + int(log(depth / ClusterParams.z) * ClusterParams.w), GRID_Z - 1);
+    }
+    vec2 uv = pos.xy / (depth * ClusterParams.xy);
+    ivec2 xy = clamp(ivec2((uv * 0.5 + 0.5) * vec2(GRID_X, GRID_Y)), ivec2(0, 0), ivec2(GRID_X - 1, GRID_Y - 1));
+    return (z * GRID_Y + xy.y) * GRID_X + xy.x;
+}
+#endif
 
 void main() {
+#ifdef FISHEYE
     vec4 FragColor = texture(Texture, fisheye(TexCoord - 0.5) + 0.5);
     //vec4 FragColor = texture(Texture, fisheye3(TexCoord * 2.0 - 1.0, vec2(FisheyeTheta, xfov_to_yfov(FisheyeTheta, 16.0/9.0))) / 2.0 + 0.5);
+#else
+    vec4 FragColor = texture(Texture, TexCoord);
+#endif
     if (FragColor.a < 0.5) {
         discard;
     }
-    if (!FullBright) {
-        if (length(Position) > DimRadius) {
-            FragColor *= 0;
-        } else if (length(Position) > BrightRadius) {
-            FragColor *= 0.30;
-        } else {
-            FragColor *= 0.80;
-        }
+#ifdef LIGHTING
+    float level = light_level(length(Position), BrightRadius, DimRadius);
+    uvec2 cell = texelFetch(LightGrid, cluster_index(Position.xyz)).rg;
+    for (uint i = cell.x; i < cell.x + cell.y; ++i) {
+        int light = int(texelFetch(LightIndices, int(i)).r);
+        vec4 a = texelFetch(LightData, light * 2);
+        vec4 b = texelFetch(LightData, light * 2 + 1);
+        level = max(level, light_level(distance(Position.xyz, a.xyz), a.w, b.x));
     }
+    FragColor *= level;
+#endif
     OutColor = FragColor.rgb;
 }
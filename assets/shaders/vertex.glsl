@@ -1,17 +1,25 @@
 #version 330
 
+// Variants are compiled by load_shader_variant; see ShaderFeature in render_pass.hpp.
+
 layout(location = 0) in vec3 VertexPosition;
 layout(location = 1) in vec2 VertexTexCoord;
 
 uniform mat4 MVP;
+
+out vec2 TexCoord;
+
+#ifdef LIGHTING
 uniform mat4 ModelMat;
 uniform mat4 ViewMat;
 
-out vec2 TexCoord;
 out vec4 Position;
+#endif
 
 void main() {
     TexCoord = VertexTexCoord;
+#ifdef LIGHTING
     Position = ViewMat * ModelMat * vec4(VertexPosition, 1.0);
+#endif
     gl_Position = MVP * vec4(VertexPosition, 1.0);
 }
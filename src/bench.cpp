@@ -0,0 +1,570 @@
+#include "game.hpp"
+#include "mesh.hpp"
+#include "post_process.hpp"
+
+#include <json/json.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Microbenchmarks for the game's hot paths.
+// Usage: bench [--filter SUBSTRING] [--samples N] [--json FILE]
+//        bench --compare BASELINE.json RESULTS.json [--threshold PERCENT]
+
+static constexpr int BENCH_VERSION = 1;
+
+// Keeps the optimizer from throwing away work whose result nothing else looks at.
+static volatile std::uint64_t sink = 0;
+
+struct BenchResult {
+    std::string name;
+    std::int64_t iterations = 0;      // Per sample
+    double median_ns = 0.0;           // Per iteration
+    double min_ns = 0.0;
+    double mpix_per_s = 0.0;          // For benchmarks that produce pixels
+    std::int64_t vs_invocations = -1; // Per op, for benchmarks that count them, where the driver can
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void()> setup; // Run once before timing, outside of it; sets up everything op depends on
+    std::function<void()> op;
+    std::int64_t pixels = 0;     // Output pixels per op, if any
+    bool count_vertices = false; // Also count one op's vertex shader invocations, after timing
+};
+
+// Batches are grown until one takes min_batch, so that clock resolution doesn't matter,
+// then `samples` batches of that size are timed. The median is what comparisons use; the minimum is for reference.
+static BenchResult run_benchmark(const Benchmark& bench, int samples) {
+    using clock = std::chrono::steady_clock;
+    constexpr auto min_batch = std::chrono::milliseconds(20);
+
+    auto time_batch = [&](std::int64_t n) {
+        auto start = clock::now();
+        for (std::int64_t i=0; i<n; ++i) {
+            bench.op();
+        }
+        return clock::now() - start;
+    };
+
+    bench.setup();
+
+    auto iterations = std::int64_t(1);
+    while (time_batch(iterations) < min_batch) {
+        iterations *= 2;
+    }
+
+    auto per_op = std::vector<double>();
+    for (int i=0; i<samples; ++i) {
+        auto elapsed = std::chrono::duration<double, std::nano>(time_batch(iterations)).count();
+        per_op.push_back(elapsed / iterations);
+    }
+    std::sort(per_op.begin(), per_op.end());
+
+    auto rv = BenchResult();
+    rv.name = bench.name;
+    rv.iterations = iterations;
+    rv.median_ns = per_op[per_op.size() / 2];
+    rv.min_ns = per_op.front();
+    rv.mpix_per_s = bench.pixels * 1e3 / rv.median_ns;
+    if (bench.count_vertices) {
+        rv.vs_invocations = std::int64_t(measure_vertex_invocations(bench.op));
+    }
+    return rv;
+}
+
+static void write_results(const std::string& fname, const std::string& renderer, const std::vector<BenchResult>& results) {
+    auto root = Json::Value(Json::objectValue);
+    root["version"] = BENCH_VERSION;
+    root["renderer"] = renderer;
+    auto& list = root["benchmarks"] = Json::Value(Json::arrayValue);
+    for (auto& r : results) {
+        auto entry = Json::Value(Json::objectValue);
+        entry["name"] = r.name;
+        entry["iterations"] = Json::Int64(r.iterations);
+        entry["median_ns"] = r.median_ns;
+        entry["min_ns"] = r.min_ns;
+        if (r.mpix_per_s > 0.0) {
+            entry["mpix_per_s"] = r.mpix_per_s;
+        }
+        if (r.vs_invocations >= 0) {
+            entry["vs_invocations"] = Json::Int64(r.vs_invocations);
+        }
+        list.append(entry);
+    }
+
+    auto file = std::ofstream(fname);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + fname + " for writing!");
+    }
+    auto builder = Json::StreamWriterBuilder();
+    auto writer = std::unique_ptr<Json::StreamWriter>(builder.newStreamWriter());
+    writer->write(root, &file);
+    file << std::endl;
+}
+
+static std::map<std::string, BenchResult> read_results(const std::string& fname) {
+    auto file = std::ifstream(fname);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + fname + "!");
+    }
+
+    auto root = Json::Value();
+    auto builder = Json::CharReaderBuilder();
+    auto errors = std::string();
+    if (!Json::parseFromStream(builder, file, &root, &errors) || !root.isObject()) {
+        throw std::runtime_error(fname + " is not a benchmark result file!");
+    }
+    if (root.get("version", 0).asInt() != BENCH_VERSION) {
+        throw std::runtime_error(fname + " has an unsupported benchmark result version!");
+    }
+
+    auto rv = std::map<std::string, BenchResult>();
+    for (auto& entry : root["benchmarks"]) {
+        auto r = BenchResult();
+        r.name = entry.get("name", "").asString();
+        r.iterations = entry.get("iterations", 0).asInt64();
+        r.median_ns = entry.get("median_ns", 0.0).asDouble();
+        r.min_ns = entry.get("min_ns", 0.0).asDouble();
+        r.mpix_per_s = entry.get("mpix_per_s", 0.0).asDouble();
+        r.vs_invocations = entry.get("vs_invocations", -1).asInt64();
+        rv[r.name] = r;
+    }
+    return rv;
+}
+
+// Prints every benchmark in both files with its change in median time.
+// Returns false if any got slower by more than threshold percent.
+static bool compare_results(const std::string& baseline_fname, const std::string& results_fname, double threshold) {
+    auto baseline = read_results(baseline_fname);
+    auto results = read_results(results_fname);
+
+    auto regressions = 0;
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right
+              << std::setw(14) << "baseline ns" << std::setw(14) << "ns" << std::setw(10) << "change" << std::endl;
+    for (auto& kv : results) {
+        // A baseline without a time for it can't be compared against, which is the same as not having one.
+        auto base = baseline.find(kv.first);
+        if (base == baseline.end() || !(base->second.median_ns > 0.0)) {
+            std::cout << std::left << std::setw(32) << kv.first << std::right << std::setw(14) << "-"
+                      << std::setw(14) << kv.second.median_ns << std::setw(10) << "new" << std::endl;
+            continue;
+        }
+        auto change = (kv.second.median_ns / base->second.median_ns - 1.0) * 100.0;
+        std::cout << std::left << std::setw(32) << kv.first << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(14) << base->second.median_ns << std::setw(14) << kv.second.median_ns
+                  << std::setw(9) << std::showpos << change << "%" << std::noshowpos;
+        if (change > threshold) {
+            std::cout << "  REGRESSION";
+            ++regressions;
+        } else if (change < -threshold) {
+            std::cout << "  improved";
+        }
+        std::cout << std::endl;
+    }
+    for (auto& kv : baseline) {
+        if (results.find(kv.first) == results.end()) {
+            std::cout << std::left << std::setw(32) << kv.first << std::right << std::setw(14) << kv.second.median_ns
+                      << std::setw(14) << "-" << std::setw(10) << "gone" << std::endl;
+        }
+    }
+
+    if (regressions > 0) {
+        std::cout << regressions << " regression(s) over " << threshold << "%" << std::endl;
+    }
+    return regressions == 0;
+}
+
+// make_random_treasure and make_random_hall as they were before Philox streams and alias tables:
+// one shared mt19937_64, and a std::discrete_distribution built on every call.
+// Kept so that --compare tracks the old path alongside the new one.
+static Treasure mt19937_random_treasure(std::mt19937_64& rng) {
+    auto rv = Treasure();
+    std::discrete_distribution<int> inhab_dist {2,3,5};
+    rv.item = Item(inhab_dist(rng));
+    return rv;
+}
+
+static std::shared_ptr<Hallway> mt19937_random_hall(std::mt19937_64& rng, int depth) {
+    auto rv = std::make_shared<Hallway>();
+    rv->depth = depth;
+
+    auto gen_difficulty = std::max(1, depth - 1);
+    std::uniform_int_distribution<int> len_dist (1+gen_difficulty/10,1+gen_difficulty/10+2);
+    rv->len = len_dist(rng);
+
+    std::discrete_distribution<int> inhab_dist ({2,1,2});
+    switch (inhab_dist(rng)) {
+        case 0:
+            rv->inhabitant = Nothing{};
+            break;
+        case 1:
+            rv->inhabitant = mt19937_random_treasure(rng);
+            break;
+        case 2: {
+            std::discrete_distribution<int> mimic_dist ({5,1});
+            if (mimic_dist(rng) == 1) {
+                rv->inhabitant = Treasure{Item::MIMIC};
+            } else {
+                rv->inhabitant = Baddy{};
+            }
+        } break;
+    }
+
+    return rv;
+}
+
+// Every benchmark's setup starts here, so that none of them depends on which ran before it.
+// The scene is the same one auto_tune measures: the start of the hall a seed of 0 makes, with a treasure in it.
+// Nothing is submitted to GL, and there is no input, no battle and no metrics overlay.
+static void setup_scene(Game& game) {
+    config = Config();
+    game.render_state.set_submit(false);
+    seed_rng(0);
+    game.cur_hall = game.make_random_hall(0, 0);
+    game.cur_hall->inhabitant = Treasure{Item::TORCH};
+    game.ensure_children(*game.cur_hall);
+    ++game.tree_version;
+    game.world_lit = true;
+    game.input = InputState();
+    game.baddy = {};
+    game.difficulty = 1;
+    game.player_health = 3;
+    game.player_items = {};
+    game.show_metrics = false;
+    game.proj_mat = glm::perspectiveFov(glm::radians(Game::fov), float(game.winwidth), float(game.winheight), 0.01f, 50.f);
+    game.view_mat = glm::mat4(1.f);
+}
+
+// A full HUD, with or without the metrics overlay. The overlay shows the gauges of one recorded frame.
+static void setup_hud(Game& game, bool show_metrics) {
+    setup_scene(game);
+    game.player_items = {Item::TORCH, Item::TORCH, Item::BOOTS, Item::HEAL, Item::BOOTS, Item::TORCH};
+    game.show_metrics = show_metrics;
+    game.render_state.begin_frame();
+    game.record_metrics(1.0 / 120.0);
+}
+
+// setup_scene, but with draws submitted, for the benchmarks that time the GPU side; their ops end with glFinish.
+static void setup_gpu_scene(Game& game) {
+    setup_scene(game);
+    game.render_state.set_submit(true);
+}
+
+// The world pass of a frame, as auto_tune draws it.
+static void draw_world_pass(Game& game) {
+    game.render_state.begin_frame();
+    game.begin_world_pass();
+    game.set_lamp_uniforms();
+    game.proj_mat = glm::perspectiveFov(glm::radians(Game::fov), float(game.winwidth), float(game.winheight), 0.01f, 50.f);
+    game.view_mat = glm::mat4(1.f);
+    game.draw_world(glm::mat4(1.f));
+}
+
+// Draws frames until the impostors for the current config are all in the cache, so none get rendered while timing.
+static void warm_up_world(Game& game) {
+    for (int i=0; i<40; ++i) {
+        draw_world_pass(game);
+        glFinish();
+        if (game.impostors.misses() == 0) {
+            break;
+        }
+    }
+}
+
+static std::vector<Benchmark> make_benchmarks(Game& game) {
+    auto rv = std::vector<Benchmark>();
+
+    // Halls at every depth up to 64, so that all the difficulty-dependent distributions get used.
+    auto hall_index = std::make_shared<std::uint64_t>();
+    rv.push_back({"make_random_hall", [&game, hall_index]{
+        setup_scene(game);
+        seed_rng(1);
+        *hall_index = 0;
+    }, [&game, hall_index]{
+        auto i = (*hall_index)++;
+        sink += std::uint64_t(game.make_random_hall(mix64(i), int(i % 64))->len);
+    }});
+
+    auto baseline_rng = std::make_shared<std::mt19937_64>();
+    rv.push_back({"make_random_hall/mt19937_baseline", [&game, hall_index, baseline_rng]{
+        setup_scene(game);
+        baseline_rng->seed(1);
+        *hall_index = 0;
+    }, [hall_index, baseline_rng]{
+        auto i = (*hall_index)++;
+        sink += std::uint64_t(mt19937_random_hall(*baseline_rng, int(i % 64))->len);
+    }});
+
+    auto treasure_rng = std::make_shared<Philox>();
+    rv.push_back({"make_random_treasure", [&game, treasure_rng]{
+        setup_scene(game);
+        *treasure_rng = Philox(1, std::uint64_t(Stream::HALLS));
+    }, [&game, treasure_rng]{
+        sink += std::uint64_t(game.make_random_treasure(*treasure_rng).item);
+    }});
+
+    rv.push_back({"make_random_treasure/mt19937_baseline", [&game, baseline_rng]{
+        setup_scene(game);
+        baseline_rng->seed(1);
+    }, [baseline_rng]{
+        sink += std::uint64_t(mt19937_random_treasure(*baseline_rng).item);
+    }});
+
+    // Draw submission is off, so this is the CPU side of a frame: planning, lights, clusters and the state tracking.
+    // No draw, upload or impostor render reaches GL, so the far halls are stubs, but the assets it would draw
+    // still come from the real context main opens.
+    rv.push_back({"draw_world", [&game]{ setup_scene(game); }, [&game]{
+        game.render_state.begin_frame();
+        game.draw_world(glm::mat4(1.f));
+    }});
+
+    // The clustered lighting path on the GPU, with config.extra_lights scattered down the hall on top of the scene's own.
+    for (auto num_lights : {0, 100, 400, 1000}) {
+        rv.push_back({"world_pass/lights_" + std::to_string(num_lights), [&game, num_lights]{
+            setup_gpu_scene(game);
+            config.extra_lights = num_lights;
+            warm_up_world(game);
+        }, [&game]{
+            draw_world_pass(game);
+            glFinish();
+        }});
+    }
+
+    // One tick of a battle that has just started, with the left key going down partway through,
+    // so the player's path has a cut in it. Every tick starts from the same state, copied back into
+    // the same BaddyState, whose bullets keep their storage from one tick to the next.
+    for (auto difficulty : {1, 5, 20, 50}) {
+        auto start = std::make_shared<Game::BaddyState>();
+        auto setup = [&game, difficulty, start]{
+            setup_scene(game);
+            game.cur_hall->inhabitant = Baddy{};
+            game.difficulty = difficulty;
+            game.start_battle();
+            game.baddy->countdown = 0.f;
+            *start = *game.baddy;
+            game.input.down = 1 << int(Button::LEFT);
+            game.input.pressed = 1 << int(Button::LEFT);
+            game.input.edges = {{Button::LEFT, true, 0.008f}};
+        };
+        rv.push_back({"battle_update/difficulty_" + std::to_string(difficulty), setup, [&game, start]{
+            auto& baddy = *game.baddy;
+            baddy.countdown = start->countdown;
+            baddy.bullets.assign(start->bullets.begin(), start->bullets.end());
+            baddy.player_pos = start->player_pos;
+            baddy.rng = start->rng;
+            game.update_battle(1.0 / 60.0);
+            sink += baddy.bullets.size();
+        }});
+    }
+
+    rv.push_back({"render_hud", [&game]{ setup_hud(game, false); }, [&game]{
+        game.render_state.begin_frame();
+        game.render_hud();
+    }});
+
+    rv.push_back({"render_hud/metrics", [&game]{ setup_hud(game, true); }, [&game]{
+        game.render_state.begin_frame();
+        game.render_hud();
+    }});
+
+    auto flicker_rng = std::make_shared<Philox>();
+    rv.push_back({"flicker_update", [&game, flicker_rng]{
+        setup_scene(game);
+        *flicker_rng = Philox(1, std::uint64_t(Stream::EFFECTS));
+    }, [&game, flicker_rng]{
+        game.flicker.update(1.0 / 60.0, *flicker_rng);
+    }});
+
+    // Lookahead depth against the time of a whole frame, world and blit, as auto_tune times it.
+    // Past the segment budget the deeper halls become impostors, which the warm up has already rendered.
+    for (int lookahead=2; lookahead<=8; ++lookahead) {
+        rv.push_back({"frame/lookahead_" + std::to_string(lookahead), [&game, lookahead]{
+            setup_gpu_scene(game);
+            config.lookahead = lookahead;
+            warm_up_world(game);
+        }, [&game]{
+            draw_world_pass(game);
+            game.blit_world(true);
+            glFinish();
+        }});
+    }
+
+    // Each pass of a frame on its own, with the GPU's share of it: the world lit and flat, the blit with
+    // and without fisheye, and the HUD with and without the metrics overlay.
+    for (auto lit : {true, false}) {
+        rv.push_back({std::string("pass/world_") + (lit ? "lit" : "flat"), [&game, lit]{
+            setup_gpu_scene(game);
+            game.world_lit = lit;
+            warm_up_world(game);
+        }, [&game]{
+            draw_world_pass(game);
+            glFinish();
+        }});
+    }
+    for (auto fisheye : {true, false}) {
+        rv.push_back({std::string("pass/blit_") + (fisheye ? "fisheye" : "flat"), [&game]{
+            setup_gpu_scene(game);
+            warm_up_world(game);
+        }, [&game, fisheye]{
+            game.render_state.begin_frame();
+            game.blit_world(fisheye);
+            glFinish();
+        }, std::int64_t(game.winwidth) * game.winheight});
+    }
+    for (auto show_metrics : {false, true}) {
+        rv.push_back({std::string("pass/hud") + (show_metrics ? "/metrics" : ""), [&game, show_metrics]{
+            setup_hud(game, show_metrics);
+            game.render_state.set_submit(true);
+            game.render_state.bind_framebuffer(0, game.winwidth, game.winheight);
+        }, [&game]{
+            game.render_state.begin_frame();
+            game.render_hud();
+            glFinish();
+        }});
+    }
+
+    // Each world mesh as loaded and as load_optimized_mesh leaves it, drawn once with the lit pass.
+    // Like report_mesh_stats, these count vertex shader invocations too, where GL_ARB_pipeline_statistics_query is there.
+    struct MeshCase {
+        const char* name;
+        const char* fname;
+        const IndexedMesh* optimized;
+    };
+    const MeshCase mesh_cases[] = {
+        {"hallway", "assets/models/hallway.obj", &game.hallobj},
+        {"junction", "assets/models/junction.obj", &game.juncobj},
+        {"treasure", "assets/models/treasure.obj", &game.treasureobj},
+    };
+    for (auto& mesh : mesh_cases) {
+        auto unindexed = std::make_shared<sushi::static_mesh>();
+        auto fname = std::string(mesh.fname);
+        rv.push_back({"draw_mesh/" + std::string(mesh.name) + "/unindexed", [&game, unindexed, fname]{
+            setup_gpu_scene(game);
+            *unindexed = sushi::load_static_mesh_file(fname);
+            game.lit_pass.bind(game.render_state);
+        }, [unindexed]{
+            sushi::draw_mesh(*unindexed);
+            glFinish();
+        }, 0, true});
+        auto optimized = mesh.optimized;
+        rv.push_back({"draw_mesh/" + std::string(mesh.name) + "/optimized", [&game]{
+            setup_gpu_scene(game);
+            game.lit_pass.bind(game.render_state);
+        }, [optimized]{
+            optimized->draw();
+            glFinish();
+        }, 0, true});
+    }
+
+    // The CPU resolve of a 1280x720 frame at AA 2, at powers of two threads up to the first that covers the machine.
+    auto resolve_src = std::make_shared<Image>();
+    auto resolve_dst = std::make_shared<Image>();
+    resolve_src->resize(1280 * 2, 720 * 2);
+    resolve_dst->resize(1280, 720);
+    auto noise = Philox(1, 0);
+    for (auto& p : resolve_src->pixels) {
+        p = std::uint32_t(noise());
+    }
+    auto max_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+    for (int threads=1; threads<max_threads*2; threads*=2) {
+        auto resolve = std::make_shared<std::unique_ptr<FisheyeResolve>>();
+        rv.push_back({"fisheye_resolve/threads_" + std::to_string(threads), [resolve, threads]{
+            *resolve = std::make_unique<FisheyeResolve>(threads);
+        }, [resolve, resolve_src, resolve_dst]{
+            (*resolve)->run(*resolve_src, *resolve_dst, 2, true);
+        }, std::int64_t(resolve_dst->width) * resolve_dst->height});
+    }
+
+    return rv;
+}
+
+int main(int argc, char* argv[]) try {
+    auto filter = std::string();
+    auto json_path = std::string();
+    auto samples = 15;
+    auto baseline_path = std::string();
+    auto compare_path = std::string();
+    auto threshold = 10.0;
+    for (int i=1; i<argc; ++i) {
+        if (std::strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--samples") == 0 && i+1 < argc) {
+            samples = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+            json_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--compare") == 0 && i+2 < argc) {
+            baseline_path = argv[++i];
+            compare_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--threshold") == 0 && i+1 < argc) {
+            threshold = std::atof(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter SUBSTRING] [--samples N] [--json FILE]" << std::endl;
+            std::cerr << "       " << argv[0] << " --compare BASELINE.json RESULTS.json [--threshold PERCENT]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!compare_path.empty()) {
+        return compare_results(baseline_path, compare_path, threshold) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // The game needs a real window and GL context to load its assets, and a mixer to play into. The GPU benchmarks
+    // draw with that context; the others keep submission off, so nothing they do reaches GL.
+    auto window = sushi::window(1280, 720, "Dungeon of Choice benchmarks", false);
+    auto renderer = std::string(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+
+    SoLoud::Soloud soloud;
+    soloud.init(SoLoud::Soloud::CLIP_ROUNDOFF, SoLoud::Soloud::NULLDRIVER);
+    SCOPE_EXIT {soloud.deinit();};
+
+    auto game = Game(&window, &soloud);
+
+    auto results = std::vector<BenchResult>();
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right
+              << std::setw(12) << "iterations" << std::setw(14) << "median ns" << std::setw(14) << "min ns"
+              << std::setw(10) << "MP/s" << std::setw(12) << "VS inv" << std::endl;
+    for (auto& bench : make_benchmarks(game)) {
+        if (bench.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        auto r = run_benchmark(bench, samples);
+        std::cout << std::left << std::setw(32) << r.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << r.iterations << std::setw(14) << r.median_ns << std::setw(14) << r.min_ns;
+        if (r.mpix_per_s > 0.0 || r.vs_invocations >= 0) {
+            std::cout << std::setw(10);
+            if (r.mpix_per_s > 0.0) {
+                std::cout << r.mpix_per_s;
+            } else {
+                std::cout << "-";
+            }
+        }
+        if (r.vs_invocations >= 0) {
+            std::cout << std::setw(12) << r.vs_invocations;
+        }
+        std::cout << std::endl;
+        results.push_back(r);
+    }
+
+    if (!json_path.empty()) {
+        write_results(json_path, renderer, results);
+    }
+
+    return EXIT_SUCCESS;
+} catch (const std::exception& e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
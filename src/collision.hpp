@@ -0,0 +1,88 @@
+#ifndef LD34_COLLISION_HPP
+#define LD34_COLLISION_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// Whether two points moving in straight lines over the same interval ever come within `radius` of each other.
+// In the frame of b this is a segment-vs-circle test, so the answer doesn't depend on how the motion was stepped.
+inline bool swept_hit(glm::vec2 a0, glm::vec2 a1, glm::vec2 b0, glm::vec2 b1, float radius) {
+    auto start = a0 - b0;
+    auto dir = (a1 - b1) - start;
+    auto len2 = glm::dot(dir, dir);
+    auto t = len2 > 0.f ? std::min(std::max(-glm::dot(start, dir) / len2, 0.f), 1.f) : 0.f;
+    auto closest = start + dir * t;
+    return glm::dot(closest, closest) < radius * radius;
+}
+
+// The dodge arena: the player slides along a line between the walls, and bullets fall until they pass the floor.
+constexpr float ARENA_WALL = 7.f;
+constexpr float ARENA_FLOOR = -7.5f;
+
+// The player's path through one battle step, as knots with straight lines between them. Its velocity changes
+// wherever a dodge key went up or down inside the step, and the path bends where it meets a wall.
+struct DodgePath {
+    struct Knot {
+        float t;
+        glm::vec2 pos;
+        float vel;
+    };
+
+    // cuts are the times the velocity may change, in order, ending with the length of the step;
+    // velocity_at(t0, t1) is the player's velocity between two of them.
+    template <typename VelocityAt>
+    DodgePath(glm::vec2 start, const std::vector<float>& cuts, VelocityAt velocity_at) {
+        auto pos = start;
+        auto t0 = 0.f;
+        for (auto t1 : cuts) {
+            auto vel = velocity_at(t0, t1);
+            knots.push_back({t0, pos, vel});
+            if (vel != 0.f) {
+                auto wall = vel < 0.f ? -ARENA_WALL : ARENA_WALL;
+                auto wall_time = t0 + (wall - pos.x) / vel;
+                if (wall_time > t0 && wall_time < t1) {
+                    knots.push_back({wall_time, {wall, pos.y}, vel});
+                }
+            }
+            pos.x = glm::clamp(pos.x + vel * (t1 - t0), -ARENA_WALL, ARENA_WALL);
+            t0 = t1;
+        }
+        knots.push_back({t0, pos, 0.f});
+    }
+
+    float duration() const { return knots.back().t; }
+    glm::vec2 end() const { return knots.back().pos; }
+
+    // Where the player is at t, which must fall within the span starting at knot.
+    glm::vec2 at(std::size_t knot, float t) const {
+        auto& k = knots[knot];
+        return {glm::clamp(k.pos.x + k.vel * (t - k.t), -ARENA_WALL, ARENA_WALL), k.pos.y};
+    }
+
+    std::vector<Knot> knots;
+};
+
+// Moves a bullet falling at speed through the step of path, and returns whether it hit the player on the way.
+// Player and bullet are tested along their whole paths through the step, so a large step can't carry
+// a bullet through the player. A bullet is gone once it passes the floor, so nothing past that point can hit.
+inline bool step_bullet(glm::vec2& pos, float speed, const DodgePath& path, float radius) {
+    auto start = pos;
+    auto bullet_at = [&](float t) {
+        return glm::vec2{start.x, start.y - speed * t};
+    };
+    auto end_time = std::min(path.duration(), (start.y - ARENA_FLOOR) / speed);
+
+    auto hit = false;
+    for (std::size_t i=0; i+1<path.knots.size() && path.knots[i].t < end_time && !hit; ++i) {
+        auto t0 = path.knots[i].t;
+        auto t1 = std::min(path.knots[i+1].t, end_time);
+        hit = swept_hit(bullet_at(t0), bullet_at(t1), path.at(i, t0), path.at(i, t1), radius);
+    }
+
+    pos = bullet_at(path.duration());
+    return hit;
+}
+
+#endif //LD34_COLLISION_HPP
@@ -0,0 +1,175 @@
+#include "collision.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Runs the same battle at several timesteps and checks that the outcome doesn't depend on the step:
+// every bullet hits or misses the same, a hit or a miss lands in the tick that contains it, and whatever
+// is left ends up in the same place. Ticks are stepped with DodgePath and step_bullet, as in Game::update_battle.
+
+namespace {
+
+constexpr float PLAYER_SPEED = 12.5f;
+constexpr float RADIUS = 0.9f;
+constexpr float DURATION = 3.f;
+
+// When the dodge keys go down and up, in seconds from the start of the battle.
+struct Hold {
+    float start;
+    float end;
+    float dir;
+};
+
+const Hold holds[] = {
+    {0.05f, 0.40f, 1.f},  // Right, partway across
+    {0.55f, 1.30f, 1.f},  // Right, into the wall
+    {1.45f, 1.47f, -1.f}, // A tap shorter than most ticks
+    {1.70f, 2.60f, -1.f}, // Left, across the whole arena
+};
+
+struct BulletStart {
+    glm::vec2 pos;
+    float speed;
+};
+
+struct Outcome {
+    int hit_tick = -1;
+    int miss_tick = -1;
+    glm::vec2 pos;
+};
+
+struct Run {
+    double dt;
+    std::vector<Outcome> bullets;
+    glm::vec2 player_pos;
+};
+
+float velocity_at(float t) {
+    auto vel = 0.f;
+    for (auto& hold : holds) {
+        if (t >= hold.start && t < hold.end) {
+            vel += hold.dir * PLAYER_SPEED;
+        }
+    }
+    return vel;
+}
+
+Run run_battle(const std::vector<BulletStart>& starts, double dt) {
+    auto rv = Run{dt, std::vector<Outcome>(starts.size()), {0.f, -7.f}};
+    for (std::size_t i=0; i<starts.size(); ++i) {
+        rv.bullets[i].pos = starts[i].pos;
+    }
+
+    auto num_ticks = int(std::ceil(DURATION / dt - 1e-6));
+    for (int tick=0; tick<num_ticks; ++tick) {
+        auto tick_start = float(tick * dt);
+        auto tick_delta = float(dt);
+
+        auto cuts = std::vector<float>();
+        for (auto& hold : holds) {
+            for (auto edge : {hold.start, hold.end}) {
+                if (edge > tick_start && edge < tick_start + tick_delta) {
+                    cuts.push_back(edge - tick_start);
+                }
+            }
+        }
+        std::sort(begin(cuts), end(cuts));
+        cuts.push_back(tick_delta);
+
+        auto path = DodgePath(rv.player_pos, cuts, [&](float t0, float t1) {
+            return velocity_at(tick_start + (t0 + t1) / 2.f);
+        });
+        rv.player_pos = path.end();
+
+        for (std::size_t i=0; i<starts.size(); ++i) {
+            auto& b = rv.bullets[i];
+            if (b.hit_tick >= 0 || b.miss_tick >= 0) {
+                continue;
+            }
+            if (step_bullet(b.pos, starts[i].speed, path, RADIUS)) {
+                b.hit_tick = tick;
+            } else if (b.pos.y <= ARENA_FLOOR) {
+                b.miss_tick = tick;
+            }
+        }
+    }
+    return rv;
+}
+
+}
+
+int main() {
+    // Bullets that reach the player's line at a spread of times, several of them while the player is
+    // sweeping across, plus some that are still falling at the end.
+    auto starts = std::vector<BulletStart>();
+    for (auto x : {-6.4f, -3.1f, 0.2f, 2.3f, 4.6f, 6.8f}) {
+        for (auto arrival : {0.12f, 0.22f, 0.33f, 0.7f, 1.f, 1.46f, 1.9f, 2.2f, 2.45f, 4.f}) {
+            starts.push_back({{x, 7.f}, 14.f / arrival});
+        }
+    }
+
+    // Small enough that the reference hit times are exact to well within any tick below.
+    auto reference = run_battle(starts, 1.0 / 4000.0);
+    auto num_hits = 0;
+    for (auto& b : reference.bullets) {
+        num_hits += b.hit_tick >= 0;
+    }
+    if (num_hits == 0 || num_hits == int(starts.size())) {
+        std::cerr << "Battle should have both hits and misses, has " << num_hits << " hits" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto failures = 0;
+    auto check_pos = [&](const Run& run, const char* what, int index, glm::vec2 got, glm::vec2 expected) {
+        if (glm::distance(got, expected) > 1e-3f) {
+            std::cerr << "dt " << run.dt << ": " << what << " " << index << " ends at (" << got.x << ", " << got.y
+                      << "), expected (" << expected.x << ", " << expected.y << ")" << std::endl;
+            ++failures;
+        }
+    };
+    auto check_tick = [&](const Run& run, const char* what, int index, int tick, double time) {
+        if (time < tick * run.dt - 1e-4 || time > (tick + 1) * run.dt + 1e-4) {
+            std::cerr << "dt " << run.dt << ": bullet " << index << " " << what << " in tick " << tick
+                      << ", expected the tick containing " << time << "s" << std::endl;
+            ++failures;
+        }
+    };
+
+    // Each of these divides DURATION, so every run ends at the same time. The last is long enough
+    // for the fastest bullets to cross the whole arena in a couple of ticks.
+    for (auto dt : {1.0 / 240.0, 1.0 / 60.0, 1.0 / 20.0, 0.1, 0.25}) {
+        auto run = run_battle(starts, dt);
+        check_pos(run, "player", 0, run.player_pos, reference.player_pos);
+
+        for (std::size_t i=0; i<starts.size(); ++i) {
+            auto& got = run.bullets[i];
+            auto& expected = reference.bullets[i];
+            if ((got.hit_tick >= 0) != (expected.hit_tick >= 0)) {
+                std::cerr << "dt " << dt << ": bullet " << i << (got.hit_tick >= 0 ? " hit" : " missed")
+                          << ", expected it to" << (expected.hit_tick >= 0 ? " hit" : " miss") << std::endl;
+                ++failures;
+                continue;
+            }
+            auto& start = starts[i];
+            if (got.hit_tick >= 0) {
+                check_tick(run, "hit", int(i), got.hit_tick, (expected.hit_tick + 0.5) * reference.dt);
+            } else if (got.miss_tick >= 0) {
+                check_tick(run, "missed", int(i), got.miss_tick, (start.pos.y - ARENA_FLOOR) / start.speed);
+            } else {
+                check_pos(run, "bullet", int(i), got.pos, {start.pos.x, start.pos.y - start.speed * DURATION});
+            }
+        }
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " failures" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Battle outcome is the same at every timestep (" << num_hits << " of " << starts.size() << " bullets hit)" << std::endl;
+    return EXIT_SUCCESS;
+}
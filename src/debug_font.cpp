@@ -0,0 +1,64 @@
+#include "debug_font.hpp"
+
+#include <cctype>
+
+constexpr int DebugFont::GLYPH_WIDTH;
+constexpr int DebugFont::GLYPH_HEIGHT;
+
+namespace {
+
+struct GlyphBits {
+    char c;
+    const char* rows; // GLYPH_HEIGHT rows of GLYPH_WIDTH, top first
+};
+
+const GlyphBits glyph_bits[] = {
+    {'0', "111101101101111"}, {'1', "010110010010111"}, {'2', "111001111100111"}, {'3', "111001111001111"},
+    {'4', "101101111001001"}, {'5', "111100111001111"}, {'6', "111100111101111"}, {'7', "111001001001001"},
+    {'8', "111101111101111"}, {'9', "111101111001111"},
+    {'.', "000000000000010"}, {':', "000010000010000"}, {'/', "001001010100100"}, {'-', "000000111000000"},
+    {'%', "101001010100101"},
+    {'A', "010101111101101"}, {'B', "110101110101110"}, {'C', "011100100100011"}, {'D', "110101101101110"},
+    {'E', "111100110100111"}, {'F', "111100110100100"}, {'G', "011100101101011"}, {'H', "101101111101101"},
+    {'I', "111010010010111"}, {'J', "001001001101010"}, {'K', "101101110101101"}, {'L', "100100100100111"},
+    {'M', "101111111101101"}, {'N', "110101101101101"}, {'O', "010101101101010"}, {'P', "110101110100100"},
+    {'Q', "010101101110011"}, {'R', "110101110101101"}, {'S', "011100010001110"}, {'T', "111010010010010"},
+    {'U', "101101101101111"}, {'V', "101101101101010"}, {'W', "101101111111101"}, {'X', "101101010101101"},
+    {'Y', "101101010010010"}, {'Z', "111001010100111"},
+};
+
+}
+
+DebugFont::DebugFont() {
+    for (auto& g : glyph_bits) {
+        GLubyte pixels[GLYPH_WIDTH * GLYPH_HEIGHT * 4];
+        for (int i=0; i<GLYPH_WIDTH * GLYPH_HEIGHT; ++i) {
+            auto v = GLubyte(g.rows[i] == '1' ? 255 : 0);
+            pixels[i*4+0] = v;
+            pixels[i*4+1] = v;
+            pixels[i*4+2] = v;
+            pixels[i*4+3] = v;
+        }
+
+        auto& tex = glyphs[int(g.c)];
+        tex = {sushi::make_unique_texture(), GLYPH_WIDTH, GLYPH_HEIGHT};
+        glBindTexture(GL_TEXTURE_2D, tex.handle.get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GLYPH_WIDTH, GLYPH_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        present[int(g.c)] = true;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+const sushi::texture_2d* DebugFont::glyph(char c) const {
+    auto i = std::toupper(static_cast<unsigned char>(c));
+    if (i >= 128 || !present[i]) {
+        return nullptr;
+    }
+    return &glyphs[i];
+}
@@ -0,0 +1,25 @@
+#ifndef LD34_DEBUG_FONT_HPP
+#define LD34_DEBUG_FONT_HPP
+
+#include <sushi/sushi.hpp>
+
+#include <array>
+
+// 3x5 pixel font for debug overlays, one tiny texture per glyph so it draws with the plain sprite mesh.
+// Covers upper case letters, digits and a little punctuation; anything else draws as a blank.
+class DebugFont {
+public:
+    static constexpr int GLYPH_WIDTH = 3;
+    static constexpr int GLYPH_HEIGHT = 5;
+
+    DebugFont();
+
+    // nullptr for blanks.
+    const sushi::texture_2d* glyph(char c) const;
+
+private:
+    std::array<sushi::texture_2d, 128> glyphs;
+    std::array<bool, 128> present = {};
+};
+
+#endif //LD34_DEBUG_FONT_HPP
@@ -0,0 +1,1366 @@
+#include "game.hpp"
+
+#include <ginseng/ginseng.hpp>
+#include <raspberry/raspberry.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+static std::uint64_t run_seed = 0;
+static Philox fx_rng;
+
+void seed_rng(std::uint64_t seed) {
+    run_seed = seed;
+    fx_rng = Philox(seed, std::uint64_t(Stream::EFFECTS));
+}
+
+static const auto default_hall = Hallway{3, {}, nullptr, nullptr};
+
+// Halls are named by their path from the root, so their contents don't depend on the order they're generated in.
+static std::uint64_t child_hall_id(const Hallway& parent, Hallway::Dir dir) {
+    return mix64(parent.id * 3 + dir);
+}
+
+static auto get_rot_mat(float deg) {
+    auto rv = glm::mat4(1.f);
+    rv = glm::translate(rv, {0.f, 0.f, 1.f});
+    rv = glm::rotate(rv, glm::radians(deg), {0.f,1.f,0.f});
+    rv = glm::translate(rv, {0.f, 0.f, -1.f});
+    rv = glm::rotate(rv, glm::radians(deg), {0.f,1.f,0.f});
+    rv = glm::translate(rv, {0.f, 0.f, -1.f});
+    return rv;
+}
+
+static const auto rot_left_mat = get_rot_mat(30.f);
+static const auto rot_right_mat = get_rot_mat(-30.f);
+
+template <typename R, typename T, typename... Ts>
+struct Overloaded : T, Overloaded<R, Ts...> {
+    using T::operator();
+    using Overloaded<R, Ts...>::operator();
+    Overloaded(T&& t, Ts&&... ts) : T(std::forward<T>(t)), Overloaded<R, Ts...>(std::forward<Ts>(ts)...) {}
+};
+
+template <typename R, typename T>
+struct Overloaded<R,T> : T, boost::static_visitor<R> {
+    using T::operator();
+    Overloaded(T&& t) : T(std::forward<T>(t)), boost::static_visitor<R>() {}
+};
+
+template <typename R, typename... Ts>
+Overloaded<R,Ts...> overload(Ts&&... ts) {
+    return Overloaded<R,Ts...>(std::forward<Ts>(ts)...);
+}
+
+Config config = {};
+
+constexpr float Game::player_speed;
+constexpr float Game::battle_speed;
+constexpr float Game::fov;
+constexpr int Game::full_detail_depth;
+constexpr int Game::impostor_depth;
+constexpr float Game::impostor_eye_distance;
+constexpr int Game::max_impostor_renders;
+
+Game::Game(sushi::window* window, SoLoud::Soloud* soloud) : window(window), soloud(soloud) {
+    hurtsfx.load("assets/sfx/hurt.wav");
+    misssfx.load("assets/sfx/miss.wav");
+    itemsfx.setText("");//.load("assets/sfx/item.wav");
+
+    winwidth = window->width();
+    winheight = window->height();
+
+    create_framebuffer();
+
+    reset();
+}
+
+void Game::reset() {
+    if (history.in_run()) {
+        history.end_run(RunEnd::QUIT, difficulty);
+    }
+    ui_state = state_title;
+    player_lost = false;
+    baddy = {};
+    treasure_state = {};
+    losetimer = {};
+    difficulty = 1;
+    player_health = 3;
+    player_pos = {0.f, 0.f, 0.f};
+    player_rot = glm::quat();
+    player_items = {};
+    cur_hall = make_random_hall(mix64(++run_count), 0);
+    cur_hall->inhabitant = {};
+    ensure_children(*cur_hall);
+    ++tree_version;
+    cur_state = nullptr;
+    hud_state = nullptr;
+}
+
+void Game::create_framebuffer() {
+    if (!framebuffer) {
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &depthrenderbuffer);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    // "Bind" the newly created texture : all future texture functions will modify this texture
+    glBindTexture(GL_TEXTURE_2D, renderedTexture.handle.get());
+
+    // Give an empty image to OpenGL ( the last "0" )
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, winwidth * config.AA, winheight * config.AA, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+
+    // Poor filtering. Needed !
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    // The depth buffer
+    glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, winwidth * config.AA, winheight * config.AA);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+
+    // Set "renderedTexture" as our colour attachement #0
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture.handle.get(), 0);
+
+    // Set the list of draw buffers.
+    GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+    // Always check that our framebuffer is ok
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("Failed to create framebuffer!");
+    }
+
+    render_state.invalidate();
+}
+
+float Game::get_run_speed() {
+    return (player_speed + std::count(begin(player_items),end(player_items),Item::BOOTS));
+}
+
+void Game::bind_world_pass() {
+    if (world_lit) {
+        lit_pass.bind(render_state);
+    } else {
+        flat_pass.bind(render_state);
+    }
+}
+
+void Game::set_world_transform(const glm::mat4& mvp, const glm::mat4& model_mat) {
+    if (world_lit) {
+        lit_pass.set_transform(render_state, mvp, model_mat, view_mat);
+    } else {
+        flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+    }
+}
+
+glm::mat4 Game::draw_hallway(const Hallway& hall, glm::mat4 model_mat) {
+    auto vp = proj_mat * view_mat;
+    render_state.set_texture(0, halltex);
+    switch (hall.from) {
+        case Hallway::LEFT: {
+            auto mmat = glm::translate(model_mat, {0.f, 0.f, 1.5773503f});
+            auto mmat2 = glm::rotate(mmat, glm::radians(60.f), {0.f, 1.f, 0.f});
+            auto mvp = vp * mmat2;
+            set_world_transform(mvp, mmat2);
+            render_state.draw_mesh(juncobj);
+            mmat2 = glm::translate(mmat2, {0.f, 0.f, 1.5773503f});
+            mvp = vp * mmat2;
+            set_world_transform(mvp, mmat2);
+            render_state.draw_mesh(hallobj);
+            mmat2 = glm::rotate(mmat, glm::radians(-60.f), {0.f, 1.f, 0.f});
+            mmat2 = glm::translate(mmat2, {0.f, 0.f, 1.5773503f});
+            mvp = vp * mmat2;
+            set_world_transform(mvp, mmat2);
+            render_state.draw_mesh(hallobj);
+        } break;
+        case Hallway::RIGHT: {
+            auto mmat = glm::translate(model_mat, {0.f, 0.f, 1.5773503f});
+            auto mmat2 = glm::rotate(mmat, glm::radians(-60.f), {0.f, 1.f, 0.f});
+            auto mvp = vp * mmat2;
+            set_world_transform(mvp, mmat2);
+            render_state.draw_mesh(juncobj);
+            mmat2 = glm::translate(mmat2, {0.f, 0.f, 1.5773503f});
+            mvp = vp * mmat2;
+            set_world_transform(mvp, mmat2);
+            render_state.draw_mesh(hallobj);
+            mmat2 = glm::rotate(mmat, glm::radians(60.f), {0.f, 1.f, 0.f});
+            mmat2 = glm::translate(mmat2, {0.f, 0.f, 1.5773503f});
+            mvp = vp * mmat2;
+            set_world_transform(mvp, mmat2);
+            render_state.draw_mesh(hallobj);
+        } break;
+        default: break;
+    }
+    for (int i=0; i<hall.len; ++i) {
+        auto mvp = vp * model_mat;
+        set_world_transform(mvp, model_mat);
+        render_state.draw_mesh(hallobj);
+        model_mat = glm::translate(model_mat, {0.f, 0.f, -2.f});
+    }
+    auto mvp = vp * model_mat;
+    set_world_transform(mvp, model_mat);
+    render_state.draw_mesh(juncobj);
+    return model_mat;
+}
+
+glm::mat4 Game::draw_hallway_simple(const Hallway& hall, const glm::mat4& model_mat) {
+    auto vp = proj_mat * view_mat;
+    render_state.set_texture(0, halltex);
+    auto hall_mat = glm::translate(model_mat, {0.f, 0.f, 1.f - hall.len});
+    hall_mat = glm::scale(hall_mat, {1.f, 1.f, float(hall.len)});
+    auto mvp = vp * hall_mat;
+    set_world_transform(mvp, hall_mat);
+    render_state.draw_mesh(hallobj);
+    auto end_mat = glm::translate(model_mat, {0.f, 0.f, -2.f * hall.len});
+    mvp = vp * end_mat;
+    set_world_transform(mvp, end_mat);
+    render_state.draw_mesh(juncobj);
+    return end_mat;
+}
+
+void Game::draw_inhabitant(const Hallway& hall, const glm::mat4& model_mat) {
+    boost::apply_visitor(overload<void>(
+        [&](const Nothing&){},
+        [&](const Treasure&){
+            auto treasure_mat = glm::translate(model_mat, {0.f, 0.f, 0.5773503f});
+            auto mvp = proj_mat * view_mat * treasure_mat;
+            set_world_transform(mvp, treasure_mat);
+            render_state.set_texture(0, treasuretex);
+            render_state.draw_mesh(treasureobj);
+        },
+        [&](const Baddy& bd){
+            auto treasure_mat = glm::translate(model_mat, {0.f, 0.f, 0.5773503f});
+            auto mvp = proj_mat * view_mat * treasure_mat;
+            set_world_transform(mvp, treasure_mat);
+            switch (bd.type) {
+                case BaddyType::BAD_DUDE:
+                    render_state.set_texture(0, baddytex);
+                    break;
+                case BaddyType::MIMIC:
+                    render_state.set_texture(0, mimictex);
+                    break;
+            }
+            render_state.draw_mesh(spriteobj);
+        }
+    ), hall.inhabitant);
+}
+
+void Game::draw_impostor(const sushi::texture_2d& texture, const glm::mat4& model_mat) {
+    auto quad_mat = glm::translate(model_mat, {0.f, 0.f, 1.f});
+    quad_mat = glm::scale(quad_mat, {1.f, -1.f, 1.f});
+    auto mvp = proj_mat * view_mat * quad_mat;
+    flat_pass.set_transform(render_state, mvp, quad_mat, view_mat);
+    render_state.set_texture(0, texture);
+    render_state.draw_mesh(spriteobj);
+}
+
+void Game::draw_planned_hallway(const HallDraw& draw) {
+    switch (draw.detail) {
+        case HallDraw::FULL:
+            draw_inhabitant(*draw.hall, draw_hallway(*draw.hall, draw.model_mat));
+            break;
+        case HallDraw::SIMPLE:
+            draw_inhabitant(*draw.hall, draw_hallway_simple(*draw.hall, draw.model_mat));
+            break;
+        case HallDraw::IMPOSTOR:
+            draw_impostor(*draw.impostor, draw.model_mat);
+            break;
+        case HallDraw::STUB:
+            draw_hallway(default_hall, draw.model_mat);
+            break;
+        default: break;
+    }
+}
+
+void Game::ensure_children(Hallway& hall) {
+    if (!hall.left) {
+        hall.left = make_random_hall(child_hall_id(hall, Hallway::LEFT), hall.depth + 1);
+    }
+    if (!hall.right) {
+        hall.right = make_random_hall(child_hall_id(hall, Hallway::RIGHT), hall.depth + 1);
+    }
+}
+
+bool Game::entrance_visible(const glm::mat4& model_mat) const {
+    auto mvp = proj_mat * view_mat * model_mat;
+    int outside[5] = {};
+    for (auto x : {-1.f, 1.f}) {
+        for (auto y : {-1.f, 1.f}) {
+            auto p = mvp * glm::vec4(x, y, 1.f, 1.f);
+            outside[0] += p.x < -p.w;
+            outside[1] += p.x > p.w;
+            outside[2] += p.y < -p.w;
+            outside[3] += p.y > p.w;
+            outside[4] += p.z < -p.w;
+        }
+    }
+    return std::none_of(std::begin(outside), std::end(outside), [](int n){ return n == 4; });
+}
+
+void Game::plan_hallways(Hallway& root, const glm::mat4& model_mat, int full_depth, int max_depth, int budget, bool use_impostors, std::vector<HallDraw>& out) {
+    struct Pending {
+        Hallway* hall;
+        glm::mat4 model_mat;
+        int depth;
+    };
+
+    auto frontier = use_impostors ? HallDraw::IMPOSTOR : HallDraw::STUB;
+    auto queue = std::deque<Pending>{{&root, model_mat, 0}};
+    while (!queue.empty()) {
+        auto cur = queue.front();
+        queue.pop_front();
+        auto& hall = *cur.hall;
+
+        if (cur.depth > 0 && !entrance_visible(cur.model_mat)) {
+            out.push_back({&hall, cur.model_mat, HallDraw::HIDDEN});
+            continue;
+        }
+
+        auto detail = cur.depth < full_depth ? HallDraw::FULL : HallDraw::SIMPLE;
+        auto cost = detail == HallDraw::FULL ? hall.len : 1;
+        if (cur.depth > 0 && (cur.depth > max_depth || cost > budget)) {
+            budget = 0;
+            out.push_back({&hall, cur.model_mat, frontier});
+            continue;
+        }
+        budget -= cost;
+        out.push_back({&hall, cur.model_mat, detail});
+
+        ensure_children(hall);
+        auto end_mat = glm::translate(cur.model_mat, {0.f, 0.f, -2.f * hall.len});
+        queue.push_back({hall.left.get(), end_mat * rot_left_mat, cur.depth + 1});
+        queue.push_back({hall.right.get(), end_mat * rot_right_mat, cur.depth + 1});
+    }
+}
+
+int Game::flicker_slot(std::uint64_t key) {
+    return 1 + int(mix64(key) % (flicker.size() - 1));
+}
+
+// A torch on alternating walls of every segment. They only reach the wall around them, so a hall
+// still fades into the dark past the lamp, with a dim patch wherever a torch is.
+void Game::gather_hallway_lights(const Hallway& hall, const glm::mat4& model_mat) {
+    for (int i=0; i<hall.len; ++i) {
+        auto side = (hall.id + i) % 2 == 0 ? -0.8f : 0.8f;
+        auto pos = view_mat * model_mat * glm::vec4(side, 0.3f, -2.f * i, 1.f);
+        // Slot 15 of each hall's keys is its inhabitant's.
+        lights.push_back({{pos.x, pos.y, pos.z}, LightSource(0.f, 0.7f, flicker_slot(hall.id * 16 + i % 15))});
+    }
+}
+
+void Game::gather_planned_lights(const std::vector<HallDraw>& draws) {
+    for (auto& draw : draws) {
+        if (draw.detail == HallDraw::IMPOSTOR || draw.detail == HallDraw::STUB) {
+            continue;
+        }
+        auto& hall = *draw.hall;
+        if (draw.detail != HallDraw::HIDDEN) {
+            gather_hallway_lights(hall, draw.model_mat);
+        }
+        auto end_mat = glm::translate(draw.model_mat, {0.f, 0.f, -2.f * hall.len});
+        auto pos = view_mat * glm::translate(end_mat, {0.f, 0.f, 0.5773503f}) * glm::vec4(0.f, 0.f, 0.f, 1.f);
+        boost::apply_visitor(overload<void>(
+            [&](const Nothing&){},
+            [&](const Treasure&){
+                lights.push_back({{pos.x, pos.y, pos.z}, LightSource(0.4f, 1.0f, flicker_slot(hall.id * 16 + 15))});
+            },
+            [&](const Baddy&){
+                lights.push_back({{pos.x, pos.y, pos.z}, LightSource(0.3f, 1.2f, flicker_slot(hall.id * 16 + 15))});
+            }
+        ), hall.inhabitant);
+    }
+}
+
+void Game::set_lamp_uniforms() {
+    if (world_lit) {
+        lit_pass.set_lamp(render_state, lamp.bright_radius + flicker.bright(lamp.flicker_slot), lamp.dim_radius + flicker.dim(lamp.flicker_slot));
+    }
+}
+
+void Game::render_impostor(ImpostorCache::Slot& slot, Hallway& hall) {
+    auto world_proj_mat = proj_mat;
+    auto world_view_mat = view_mat;
+    proj_mat = glm::frustum(-1.f, 1.f, -1.f, 1.f, impostor_eye_distance, 50.f);
+    view_mat = glm::translate(glm::mat4(1.f), {0.f, 0.f, -1.f - impostor_eye_distance});
+
+    impostor_draws.clear();
+    plan_hallways(hall, glm::mat4(1.f), 0, impostor_depth, config.segment_budget, false, impostor_draws);
+
+    lights.clear();
+    gather_planned_lights(impostor_draws);
+    impostor_clusters.build(lights, flicker, 1.f / impostor_eye_distance, 1.f / impostor_eye_distance);
+    impostor_clusters.upload(render_state);
+    impostor_clusters.bind(render_state);
+    if (world_lit) {
+        lit_pass.set_clusters(render_state, impostor_clusters.params());
+        // The lamp is with the player, nowhere near here.
+        lit_pass.set_lamp(render_state, 0.f, 0.f);
+    }
+
+    render_state.bind_framebuffer(slot.framebuffer, ImpostorCache::SIZE, ImpostorCache::SIZE);
+    render_state.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for (auto& draw : impostor_draws) {
+        draw_planned_hallway(draw);
+    }
+
+    proj_mat = world_proj_mat;
+    view_mat = world_view_mat;
+    frame_metrics.impostor_renders.add();
+}
+
+void Game::draw_world(const glm::mat4& model_mat) {
+    bind_world_pass();
+    hall_draws.clear();
+    plan_hallways(*cur_hall, model_mat, full_detail_depth, config.lookahead, config.segment_budget, true, hall_draws);
+
+    // Impostors bake in full brightness, so it is part of the version they are valid for.
+    auto impostor_version = tree_version * 2 + (input.is_down(Button::FULLBRIGHT) ? 1 : 0);
+    auto impostor_renders = 0;
+    impostors.begin_frame();
+    for (auto& draw : hall_draws) {
+        if (draw.detail != HallDraw::IMPOSTOR) {
+            continue;
+        }
+        draw.impostor = impostors.find(draw.hall->id, impostor_version);
+        // Nothing would reach the texture with submission off, so nothing is cached for later either.
+        if (!draw.impostor && impostor_renders < max_impostor_renders && render_state.submitting()) {
+            if (auto slot = impostors.acquire(draw.hall->id, impostor_version)) {
+                render_impostor(*slot, *draw.hall);
+                draw.impostor = &slot->texture;
+                ++impostor_renders;
+            }
+        }
+        // Out of slots or out of time this frame; it will be rendered on a later one.
+        if (!draw.impostor) {
+            draw.detail = HallDraw::STUB;
+        }
+    }
+    if (impostor_renders > 0) {
+        render_state.bind_framebuffer(framebuffer, winwidth * config.AA, winheight * config.AA);
+        set_lamp_uniforms();
+    }
+
+    lights.clear();
+    gather_planned_lights(hall_draws);
+
+    // Extra lights scattered down the current hall, for measuring the clustered path (--lights N).
+    for (int i=0; i<config.extra_lights; ++i) {
+        auto rng = Philox(0, std::uint64_t(i));
+        auto across = std::uniform_real_distribution<float>(-0.9f, 0.9f);
+        auto along = std::uniform_real_distribution<float>(-2.f * cur_hall->len, 1.f);
+        auto pos = view_mat * model_mat * glm::vec4(across(rng), across(rng), along(rng), 1.f);
+        lights.push_back({{pos.x, pos.y, pos.z}, LightSource(0.3f, 0.8f, flicker_slot(i))});
+    }
+
+    auto tan_y = std::tan(glm::radians(fov) / 2.f);
+    light_clusters.build(lights, flicker, tan_y * winwidth / winheight, tan_y);
+    light_clusters.upload(render_state);
+    light_clusters.bind(render_state);
+    if (world_lit) {
+        lit_pass.set_clusters(render_state, light_clusters.params());
+    }
+
+    // Impostors go last, together, so that the world only switches to the flat pass and back once.
+    int num_detail[HallDraw::NUM_DETAILS] = {};
+    for (auto& draw : hall_draws) {
+        if (draw.detail != HallDraw::IMPOSTOR) {
+            draw_planned_hallway(draw);
+        }
+        ++num_detail[draw.detail];
+    }
+    if (num_detail[HallDraw::IMPOSTOR] > 0) {
+        flat_pass.bind(render_state);
+        for (auto& draw : hall_draws) {
+            if (draw.detail == HallDraw::IMPOSTOR) {
+                draw_planned_hallway(draw);
+            }
+        }
+        bind_world_pass();
+    }
+
+    frame_metrics.halls_full.set(num_detail[HallDraw::FULL]);
+    frame_metrics.halls_simple.set(num_detail[HallDraw::SIMPLE]);
+    frame_metrics.halls_impostor.set(num_detail[HallDraw::IMPOSTOR]);
+    frame_metrics.halls_stub.set(num_detail[HallDraw::STUB]);
+    frame_metrics.halls_hidden.set(num_detail[HallDraw::HIDDEN]);
+    frame_metrics.impostor_hits.set(impostors.hits());
+}
+
+void Game::main_loop(double delta) {
+    if (input.was_pressed(Button::METRICS)) {
+        show_metrics = !show_metrics;
+    }
+
+    if (input.was_pressed(Button::ESCAPE)) {
+        if (ui_state == &state_title) {
+            quit = true;
+        } else {
+            reset();
+        }
+    }
+
+    world_timer.begin(render_state);
+    world_lit = !input.is_down(Button::FULLBRIGHT);
+    begin_world_pass();
+
+    auto player_lamps = std::count(begin(player_items),end(player_items),Item::TORCH);
+
+    lamp.bright_radius = player_lamps * 2;
+    lamp.dim_radius = player_lamps * 3 + 2;
+
+    flicker.update(delta, fx_rng);
+    set_lamp_uniforms();
+
+    if (!player_lost && player_health <= 0) {
+        player_lost = true;
+        history.end_run(RunEnd::LOST, difficulty);
+        cur_state = state_lose;
+        ui_state = nullptr;
+    }
+
+    proj_mat = glm::perspectiveFov(glm::radians(fov), float(winwidth), float(winheight), 0.01f, 50.f);
+    if (cur_state) {
+        using clock = std::chrono::high_resolution_clock;
+        auto& state_us = *frame_metrics.state_us[state_index(cur_state)];
+        auto start = clock::now();
+        (this->*cur_state)(delta);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+        state_us.add(elapsed.count());
+    }
+
+    world_timer.end();
+
+    blit_timer.begin(render_state);
+    blit_world(!input.is_down(Button::NO_FISHEYE));
+    blit_timer.end();
+
+    ui_timer.begin(render_state);
+    if (hud_state) {
+        (this->*hud_state)();
+    }
+    if (ui_state) {
+        (this->*ui_state)(delta);
+    }
+    ui_timer.end();
+}
+
+void Game::begin_world_pass() {
+    // Render to our framebuffer
+    render_state.bind_framebuffer(framebuffer, winwidth * config.AA, winheight * config.AA);
+    render_state.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    bind_world_pass();
+}
+
+void Game::blit_world(bool fisheye) {
+    // Render to the screen
+    render_state.bind_framebuffer(0, winwidth, winheight);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+
+    proj_mat = glm::ortho(-1.f,1.f,1.f,-1.f,-1.f,1.f);
+    view_mat = glm::mat4();
+    auto model_mat = glm::mat4();
+
+    auto mvp = proj_mat * view_mat * model_mat;
+    if (cpu_resolve && render_state.submitting()) {
+        resolve_on_cpu(fisheye);
+        flat_pass.bind(render_state);
+        flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+    } else if (fisheye) {
+        fisheye_pass.bind(render_state);
+        fisheye_pass.set_transform(render_state, mvp, model_mat, view_mat);
+        render_state.set_texture(0, renderedTexture);
+    } else {
+        flat_pass.bind(render_state);
+        flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+        render_state.set_texture(0, renderedTexture);
+    }
+    render_state.draw_mesh(spriteobj);
+}
+
+void Game::resolve_on_cpu(bool fisheye) {
+    resolve_src.resize(winwidth * config.AA, winheight * config.AA);
+    resolve_dst.resize(winwidth, winheight);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadPixels(0, 0, resolve_src.width, resolve_src.height, GL_RGBA, GL_UNSIGNED_BYTE, resolve_src.pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    using clock = std::chrono::high_resolution_clock;
+    auto start = clock::now();
+    cpu_resolve->run(resolve_src, resolve_dst, config.AA, fisheye);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+    frame_metrics.cpu_resolve_us.record(elapsed.count());
+
+    // RenderState leaves unit 0 active, so the upload below goes to the texture bound here.
+    render_state.set_texture(0, resolved_texture);
+    if (resolved_texture.width != winwidth || resolved_texture.height != winheight) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, winwidth, winheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, resolve_dst.pixels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        resolved_texture.width = winwidth;
+        resolved_texture.height = winheight;
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, winwidth, winheight, GL_RGBA, GL_UNSIGNED_BYTE, resolve_dst.pixels.data());
+    }
+}
+
+void Game::apply_anisotropy() {
+    auto level = 1.f;
+    if (config.anisotropic) {
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &level);
+    }
+    for (auto tex : {&halltex, &treasuretex, &baddytex, &mimictex}) {
+        glBindTexture(GL_TEXTURE_2D, tex->handle.get());
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, level);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    render_state.invalidate();
+}
+
+double Game::auto_tune(double target_ms) {
+    struct Candidate {
+        int AA;
+        bool anisotropic;
+        int lookahead;
+    };
+    static const Candidate candidates[] = {
+        {3, true, 6},
+        {2, true, 6},
+        {2, true, 4},
+        {2, false, 4},
+        {1, true, 4},
+        {1, false, 3},
+        {1, false, 2},
+    };
+    constexpr int warmup_frames = 40;
+    constexpr int timed_frames = 12;
+
+    using clock = std::chrono::high_resolution_clock;
+
+    auto game_seed = run_seed;
+    auto game_hall = cur_hall;
+    run_seed = 0;
+    cur_hall = make_random_hall(0, 0);
+    cur_hall->inhabitant = Treasure{Item::TORCH};
+
+    auto frame = [&]{
+        render_state.begin_frame();
+        world_lit = true;
+        begin_world_pass();
+        set_lamp_uniforms();
+        proj_mat = glm::perspectiveFov(glm::radians(fov), float(winwidth), float(winheight), 0.01f, 50.f);
+        view_mat = glm::mat4(1.f);
+        draw_world(glm::mat4(1.f));
+        blit_world(true);
+        glFinish();
+    };
+
+    auto frame_ms = 0.0;
+    for (auto& c : candidates) {
+        if (c.AA != config.AA) {
+            config.AA = c.AA;
+            create_framebuffer();
+        }
+        if (c.anisotropic != config.anisotropic) {
+            config.anisotropic = c.anisotropic;
+            apply_anisotropy();
+        }
+        config.lookahead = c.lookahead;
+
+        // Until the impostors for this lookahead are all in the cache.
+        for (int i=0; i<warmup_frames; ++i) {
+            frame();
+            if (impostors.misses() == 0) {
+                break;
+            }
+        }
+
+        auto start = clock::now();
+        for (int i=0; i<timed_frames; ++i) {
+            frame();
+        }
+        frame_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / timed_frames;
+        std::clog << "Tuning: AA " << c.AA << ", anisotropic " << c.anisotropic << ", lookahead " << c.lookahead
+                  << ": " << frame_ms << "ms" << std::endl;
+        if (frame_ms <= target_ms) {
+            break;
+        }
+    }
+
+    run_seed = game_seed;
+    cur_hall = game_hall;
+    ++tree_version;
+    render_state.invalidate();
+    return frame_ms;
+}
+
+struct NamedState {
+    Game::State state;
+    const char* name;
+};
+
+static const NamedState named_states[] = {
+    {&Game::state_lose, "lose"},
+    {&Game::state_moving, "moving"},
+    {&Game::state_tojunc, "tojunc"},
+    {&Game::state_turnleft, "turnleft"},
+    {&Game::state_turnright, "turnright"},
+    {&Game::state_whichway, "whichway"},
+    {&Game::state_treasure, "treasure"},
+    {&Game::state_treasure_get, "treasure_get"},
+    {&Game::state_baddy, "baddy"},
+    {&Game::state_battlewin, "battlewin"},
+};
+
+constexpr int num_named_states = sizeof(named_states) / sizeof(named_states[0]);
+
+int Game::state_index(State state) {
+    for (int i=0; i<num_named_states; ++i) {
+        if (named_states[i].state == state) {
+            return i;
+        }
+    }
+    return num_named_states;
+}
+
+const char* Game::state_name(State state) const {
+    auto i = state_index(state);
+    return i < num_named_states ? named_states[i].name : "other";
+}
+
+Game::FrameMetrics::FrameMetrics(MetricsRegistry& metrics) :
+    frames(metrics.counter("frames")),
+    impostor_renders(metrics.counter("impostor_renders")),
+    frame_time_us(metrics.histogram("frame_time_us")),
+    draw_calls_hist(metrics.histogram("draw_calls")),
+    uniform_uploads_hist(metrics.histogram("uniform_uploads")),
+    texture_binds_hist(metrics.histogram("texture_binds")),
+    gpu_world_us(metrics.histogram("gpu_world_us")),
+    gpu_blit_us(metrics.histogram("gpu_blit_us")),
+    gpu_ui_us(metrics.histogram("gpu_ui_us")),
+    cpu_resolve_us(metrics.histogram("cpu_resolve_us")),
+    input_latency_us(metrics.histogram("input_latency_us")),
+    frame_time_ms(metrics.gauge("frame_time_ms")),
+    draw_calls(metrics.gauge("draw_calls")),
+    uniform_uploads(metrics.gauge("uniform_uploads")),
+    uniform_uploads_elided(metrics.gauge("uniform_uploads_elided")),
+    texture_binds(metrics.gauge("texture_binds")),
+    texture_binds_elided(metrics.gauge("texture_binds_elided")),
+    lights(metrics.gauge("lights")),
+    bullets_alive(metrics.gauge("bullets_alive")),
+    halls_allocated(metrics.gauge("halls_allocated")),
+    audio_voices(metrics.gauge("audio_voices")),
+    halls_full(metrics.gauge("halls_full")),
+    halls_simple(metrics.gauge("halls_simple")),
+    halls_impostor(metrics.gauge("halls_impostor")),
+    halls_stub(metrics.gauge("halls_stub")),
+    halls_hidden(metrics.gauge("halls_hidden")),
+    impostor_hits(metrics.gauge("impostor_hits")),
+    gpu_world_ms(metrics.gauge("gpu_world_ms")),
+    gpu_blit_ms(metrics.gauge("gpu_blit_ms")),
+    gpu_ui_ms(metrics.gauge("gpu_ui_ms")),
+    music_underruns(metrics.gauge("music_underruns")),
+    music_decode_ms(metrics.gauge("music_decode_ms")),
+    music_decode_max_ms(metrics.gauge("music_decode_max_ms")),
+    music_buffer_fill(metrics.gauge("music_buffer_fill")) {
+    for (int i=0; i<=num_named_states; ++i) {
+        auto name = i < num_named_states ? named_states[i].name : "other";
+        state_us.push_back(&metrics.counter(std::string("state_us.") + name));
+    }
+}
+
+void Game::record_metrics(double frame_time) {
+    auto& gl = render_state.last_frame();
+    auto& m = frame_metrics;
+    m.frames.add();
+    m.frame_time_us.record(std::uint64_t(frame_time * 1e6));
+    m.frame_time_ms.set(frame_time * 1e3);
+    m.draw_calls_hist.record(gl.draws);
+    m.uniform_uploads_hist.record(gl.uniforms.issued);
+    m.texture_binds_hist.record(gl.textures.issued);
+    m.draw_calls.set(gl.draws);
+    m.uniform_uploads.set(gl.uniforms.issued);
+    m.uniform_uploads_elided.set(gl.uniforms.elided);
+    m.texture_binds.set(gl.textures.issued);
+    m.texture_binds_elided.set(gl.textures.elided);
+    m.lights.set(light_clusters.num_lights());
+    m.bullets_alive.set(baddy ? baddy->bullets.size() : 0);
+    m.halls_allocated.set(InstanceCount<Hallway>::live);
+    m.audio_voices.set(soloud->getActiveVoiceCount());
+    m.gpu_world_us.record(std::uint64_t(world_timer.last_ms() * 1e3));
+    m.gpu_blit_us.record(std::uint64_t(blit_timer.last_ms() * 1e3));
+    m.gpu_ui_us.record(std::uint64_t(ui_timer.last_ms() * 1e3));
+    m.gpu_world_ms.set(world_timer.last_ms());
+    m.gpu_blit_ms.set(blit_timer.last_ms());
+    m.gpu_ui_ms.set(ui_timer.last_ms());
+    if (music) {
+        m.music_underruns.set(music->underruns());
+        m.music_decode_ms.set(music->decode_seconds() * 1e3);
+        m.music_decode_max_ms.set(music->max_decode_seconds() * 1e3);
+        m.music_buffer_fill.set(music->fill());
+    }
+}
+
+void Game::draw_text(const std::string& text, float x, float y, float px) {
+    for (auto c : text) {
+        if (auto glyph = font.glyph(c)) {
+            auto model_mat = glm::translate(glm::mat4(1.f), {x + px * DebugFont::GLYPH_WIDTH / 2.f, y - px * DebugFont::GLYPH_HEIGHT / 2.f, 0.f});
+            model_mat = glm::scale(model_mat, {px * DebugFont::GLYPH_WIDTH / 2.f, px * DebugFont::GLYPH_HEIGHT / 2.f, 1.f});
+            auto mvp = proj_mat * view_mat * model_mat;
+            flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+            render_state.set_texture(0, *glyph);
+            render_state.draw_mesh(spriteobj);
+        }
+        x += px * (DebugFont::GLYPH_WIDTH + 1);
+    }
+}
+
+void Game::report_mesh_stats() {
+    struct Entry {
+        const char* fname;
+        const IndexedMesh* optimized;
+    };
+    const Entry entries[] = {
+        {"assets/models/hallway.obj", &hallobj},
+        {"assets/models/junction.obj", &juncobj},
+        {"assets/models/treasure.obj", &treasureobj},
+    };
+
+    lit_pass.bind(render_state);
+    for (auto& entry : entries) {
+        auto unindexed = sushi::load_static_mesh_file(entry.fname);
+        auto before = measure_vertex_invocations([&]{ sushi::draw_mesh(unindexed); });
+        auto after = measure_vertex_invocations([&]{ entry.optimized->draw(); });
+        if (before < 0) {
+            std::clog << "Mesh stats: GL_ARB_pipeline_statistics_query not available." << std::endl;
+            return;
+        }
+        std::clog << "Mesh " << entry.fname << ": VS invocations measured " << before << " -> " << after << std::endl;
+    }
+}
+
+void Game::render_metrics_overlay() {
+    proj_mat = glm::ortho(0.f,float(winwidth),0.f,float(winheight),-1.f,1.f);
+    view_mat = glm::mat4();
+    flat_pass.bind(render_state);
+
+    auto& m = frame_metrics;
+    std::ostringstream lines[6];
+    lines[0] << std::fixed << std::setprecision(1)
+             << "FRAME " << m.frame_time_ms.value() << "MS"
+             << " P99 " << m.frame_time_us.percentile(99) / 1000.0 << "MS";
+    lines[1] << "DRAWS " << m.draw_calls.value()
+             << " UNIF " << m.uniform_uploads.value() << "/" << m.uniform_uploads_elided.value()
+             << " TEX " << m.texture_binds.value() << "/" << m.texture_binds_elided.value();
+    lines[2] << "LIGHTS " << m.lights.value()
+             << " BULLETS " << m.bullets_alive.value()
+             << " HALLS " << m.halls_allocated.value()
+             << " VOICES " << m.audio_voices.value();
+    lines[3] << "HALLS FULL " << m.halls_full.value()
+             << " SIMPLE " << m.halls_simple.value()
+             << " IMP " << m.halls_impostor.value() << "/" << m.impostor_hits.value()
+             << " STUB " << m.halls_stub.value();
+    lines[4] << "GPU WORLD " << m.gpu_world_ms.value() << "MS"
+             << " BLIT " << m.gpu_blit_ms.value() << "MS"
+             << " UI " << m.gpu_ui_ms.value() << "MS";
+    lines[5] << "STATE " << (cur_state ? state_name(cur_state) : "NONE");
+
+    auto px = 3.f;
+    auto y = winheight - 96.f;
+    for (auto& l : lines) {
+        draw_text(l.str(), 16.f, y, px);
+        y -= px * (DebugFont::GLYPH_HEIGHT + 2);
+    }
+}
+
+std::shared_ptr<Hallway> Game::make_random_hall(std::uint64_t id, int depth) {
+    auto rv = std::make_shared<Hallway>();
+    rv->id = id;
+    rv->depth = depth;
+    auto rng = Philox(run_seed, std::uint64_t(Stream::HALLS)).split(id);
+
+    auto gen_difficulty = std::max(1, depth - 1);
+    std::uniform_int_distribution<int> len_dist (1+gen_difficulty/10,1+gen_difficulty/10+2);
+    rv->len = len_dist(rng);
+
+    static const auto inhab_dist = AliasTable<3>({2,1,2});
+    switch (inhab_dist(rng)) {
+        case 0:
+            rv->inhabitant = Nothing{};
+            break;
+        case 1:
+            rv->inhabitant = make_random_treasure(rng);
+            break;
+        case 2: {
+            static const auto mimic_dist = AliasTable<2>({5,1});
+            if (mimic_dist(rng) == 1) {
+                rv->inhabitant = Treasure{Item::MIMIC};
+            } else {
+                rv->inhabitant = Baddy{};
+            }
+        } break;
+    }
+
+    return rv;
+}
+
+RoomRecord Game::room_record(const Hallway& hall) {
+    auto rv = RoomRecord();
+    rv.len = hall.len;
+    rv.contents = boost::apply_visitor(overload<RoomContents>(
+        [](const Nothing&){ return RoomContents::EMPTY; },
+        [](const Treasure& t){
+            switch (t.item) {
+                case Item::TORCH: return RoomContents::TORCH;
+                case Item::BOOTS: return RoomContents::BOOTS;
+                case Item::HEAL: return RoomContents::HEAL;
+                default: return RoomContents::MIMIC;
+            }
+        },
+        [](const Baddy&){ return RoomContents::BADDY; }
+    ), hall.inhabitant);
+    return rv;
+}
+
+Treasure Game::make_random_treasure(Philox& rng) {
+    auto rv = Treasure();
+
+    static_assert(int(Item::NUM_ITEMS)==3, "Item count mismatch!");
+    // TORCH, BOOTS, HEAL
+    static const auto inhab_dist = AliasTable<3>({2,3,5});
+    rv.item = Item(inhab_dist(rng));
+
+    return rv;
+}
+
+void Game::state_lose(double delta) {
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+
+    if (!losetimer) {
+        losetimer = std::make_shared<LoseTimer>();
+    }
+    losetimer->timer -= delta;
+    if (losetimer->timer <= 0) {
+        cur_state = nullptr;
+        ui_state = state_gameover;
+        losetimer = {};
+    }
+}
+
+void Game::state_moving(double delta) {
+    auto until_stop = cur_hall->len * 2.f - 2.f - player_pos.z;
+    auto step_size = delta * get_run_speed();
+
+    if (until_stop < step_size) {
+        player_pos.z += until_stop;
+        cur_state = boost::apply_visitor(overload<State>(
+            [&](const Nothing&){ return &state_tojunc; },
+            [&](const Treasure&){ return &state_treasure; },
+            [&](const Baddy&){ return &state_baddy; }
+        ), cur_hall->inhabitant);
+    } else {
+        player_pos.z += step_size;
+    }
+
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+}
+
+void Game::state_tojunc(double delta) {
+    auto until_stop = cur_hall->len * 2.f - 0.4226497f - player_pos.z;
+    auto step_size = delta * get_run_speed();
+
+    if (until_stop < step_size) {
+        player_pos.z += until_stop;
+        cur_state = state_whichway;
+    } else {
+        player_pos.z += step_size;
+    }
+
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+}
+
+void Game::state_turnleft(double delta) {
+    auto until_stop = glm::radians(-60.f) - glm::yaw(player_rot);
+    auto step_size = -float(delta * player_speed);
+
+    if (until_stop > step_size) {
+        player_rot *= glm::angleAxis(until_stop, glm::vec3{0.f, 1.f, 0.f});
+        cur_hall = cur_hall->left;
+        ensure_children(*cur_hall);
+        history.next_room(RoomChoice::LEFT, room_record(*cur_hall));
+        player_pos.z = -1.5773503f;
+        player_rot = glm::quat();
+        cur_state = state_moving;
+        cur_hall->from = Hallway::LEFT;
+        ++difficulty;
+    } else {
+        player_rot *= glm::angleAxis(step_size, glm::vec3{0.f, 1.f, 0.f});
+    }
+
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+}
+
+void Game::state_turnright(double delta) {
+    auto until_stop = glm::radians(60.f) - glm::yaw(player_rot);
+    auto step_size = float(delta * player_speed);
+
+    if (until_stop < step_size) {
+        player_rot *= glm::angleAxis(until_stop, glm::vec3{0.f, 1.f, 0.f});
+        cur_hall = cur_hall->right;
+        ensure_children(*cur_hall);
+        history.next_room(RoomChoice::RIGHT, room_record(*cur_hall));
+        player_pos.z = -1.5773503f;
+        player_rot = glm::quat();
+        cur_state = state_moving;
+        cur_hall->from = Hallway::RIGHT;
+        ++difficulty;
+    } else {
+        player_rot *= glm::angleAxis(step_size, glm::vec3{0.f, 1.f, 0.f});
+    }
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+}
+
+void Game::state_whichway(double delta) {
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    if (input.was_pressed(Button::LEFT)) {
+        cur_state = state_turnleft;
+    }
+    if (input.was_pressed(Button::RIGHT)) {
+        cur_state = state_turnright;
+    }
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+}
+
+void Game::state_treasure(double delta) {
+    if (!treasure_state) {
+        treasure_state = std::make_shared<TreasureState>();
+        treasure_state->treasure = boost::get<Treasure>(cur_hall->inhabitant);
+    }
+
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+
+    treasure_state->timer -= delta;
+
+    if (treasure_state->timer <= 0) {
+        cur_hall->inhabitant = Nothing{};
+        ++tree_version;
+        cur_state = state_treasure_get;
+        switch (treasure_state->treasure.item) {
+            case Item::TORCH:
+                itemsfx.setText("Light Source");
+                break;
+            case Item::BOOTS:
+                itemsfx.setText("Speed Boots");
+                break;
+            case Item::HEAL:
+                itemsfx.setText("Hart");
+                break;
+            case Item::MIMIC:
+                itemsfx.setText("Memic");
+                cur_hall->inhabitant = Baddy{BaddyType::MIMIC};
+                ++tree_version;
+                break;
+        }
+        itemsfx.setVolume(1.f);
+        soloud->play(itemsfx);
+        treasure_state->timer = 1.f;
+    };
+}
+
+void Game::state_treasure_get(double delta) {
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+
+    auto w = float(winwidth);
+    auto h = float(winheight);
+    proj_mat = glm::ortho(-w/2.f,w/2.f,-h/2.f,h/2.f,-1.f,1.f);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+    view_mat = glm::mat4();
+    model_mat = glm::scale(glm::mat4(1.f), {64.f,64.f,1.f});
+    flat_pass.bind(render_state);
+
+    if (treasure_state->treasure.item != Item::MIMIC) {
+        auto mvp = proj_mat * view_mat * model_mat;
+        flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+        render_state.set_texture(0, itemtexs[int(treasure_state->treasure.item)]);
+        render_state.draw_mesh(spriteobj);
+        model_mat = glm::translate(model_mat, {2.f,0.f,0.f});
+    }
+
+    treasure_state->timer -= delta;
+
+    if (treasure_state->timer <= 0) {
+        switch (treasure_state->treasure.item) {
+            case Item::TORCH:
+                player_items.push_back(Item::TORCH);
+                history.room().item = RoomItem::TORCH;
+                cur_state = state_tojunc;
+                break;
+            case Item::BOOTS:
+                player_items.push_back(Item::BOOTS);
+                history.room().item = RoomItem::BOOTS;
+                cur_state = state_tojunc;
+                break;
+            case Item::HEAL:
+                ++player_health;
+                history.room().item = RoomItem::HEAL;
+                cur_state = state_tojunc;
+                break;
+            case Item::MIMIC:
+                cur_state = state_baddy;
+                break;
+        }
+        treasure_state = {};
+    };
+}
+
+void Game::start_battle() {
+    std::uniform_real_distribution<float> spawn_dist (-7.5f,7.5f);
+    baddy = std::make_shared<BaddyState>();
+    baddy->rng = Philox(run_seed, std::uint64_t(Stream::BATTLES)).split(cur_hall->id);
+    for (int i=0; i<difficulty*3+1; ++i) {
+        baddy->bullets.push_back({{spawn_dist(baddy->rng),7.f+2*i}});
+    }
+}
+
+void Game::state_baddy(double delta) {
+    if (!baddy) {
+        start_battle();
+    }
+
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+
+    update_battle(delta);
+}
+
+void Game::update_battle(double delta) {
+    baddy->countdown -= delta;
+    if (baddy->countdown > 0) {
+        return;
+    }
+
+    ui_state = baddy_ui_state;
+
+    // Only the part of the step after the countdown ran out is battle time.
+    auto battle_delta = float(std::min(delta, double(-baddy->countdown)));
+
+    auto player_battle_speed = battle_speed * (std::count(begin(player_items),end(player_items),Item::BOOTS) + 1);
+
+    // The player's velocity changes wherever a dodge key went up or down inside the tick.
+    auto battle_start = float(delta) - battle_delta;
+    auto cuts = std::vector<float>();
+    for (auto& edge : input.edges) {
+        if ((edge.button == Button::LEFT || edge.button == Button::RIGHT) && edge.offset > battle_start) {
+            cuts.push_back(std::min(edge.offset - battle_start, battle_delta));
+        }
+    }
+    cuts.push_back(battle_delta);
+
+    auto path = DodgePath(baddy->player_pos, cuts, [&](float t0, float t1) {
+        auto held_at = battle_start + (t0 + t1) / 2.f;
+        auto vel = 0.f;
+        if (input.is_down_at(Button::LEFT, held_at)) {
+            vel -= player_battle_speed;
+        }
+        if (input.is_down_at(Button::RIGHT, held_at)) {
+            vel += player_battle_speed;
+        }
+        return vel;
+    });
+    baddy->player_pos = path.end();
+
+    auto bullet_speed = battle_speed * difficulty / 7.5f + 2.f;
+
+    for (auto& b : baddy->bullets) {
+        auto hit = step_bullet(b.pos, bullet_speed, path, 0.9f);
+
+        if (hit) {
+            --player_health;
+            ++history.room().damage;
+            b.alive = false;
+            soloud->play(hurtsfx);
+        } else if (b.pos.y <= ARENA_FLOOR) {
+            b.alive = false;
+            soloud->play(misssfx);
+        }
+    }
+
+    baddy->bullets.erase(std::remove_if(baddy->bullets.begin(),baddy->bullets.end(),[](auto b){return !b.alive;}),baddy->bullets.end());
+
+    if (baddy->bullets.empty()) {
+        cur_state = state_battlewin;
+        ui_state = nullptr;
+        baddy->countdown = 1.f;
+    };
+}
+
+void Game::state_battlewin(double delta) {
+    view_mat = mat4_cast(player_rot) * glm::mat4(1.f);
+    view_mat = glm::translate(view_mat, player_pos);
+
+    auto model_mat = glm::mat4(1.f);
+    draw_world(model_mat);
+
+    baddy->countdown -= delta;
+    if (baddy->countdown > 0) {
+        return;
+    }
+
+    auto rng = baddy->rng;
+    baddy = {};
+    auto bt = boost::get<Baddy>(cur_hall->inhabitant).type;
+    cur_hall->inhabitant = Nothing{};
+    ++tree_version;
+
+    static const auto drops = AliasTable<2>({3,1});
+
+    if (bt == BaddyType::MIMIC || drops(rng) == 1) {
+        treasure_state = std::make_shared<TreasureState>();
+        treasure_state->treasure = make_random_treasure(rng);
+        cur_state = state_treasure;
+    } else {
+        cur_state = state_tojunc;
+    }
+}
+
+void Game::baddy_ui_state(double delta) {
+    auto w = float(winwidth);
+    auto h = float(winheight);
+    proj_mat = glm::ortho(-w/2.f,w/2.f,-h/2.f,h/2.f,-1.f,1.f);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+    view_mat = glm::mat4();
+    auto model_mat = glm::scale(glm::mat4(1.f), {256.f,256.f,1.f});
+    flat_pass.bind(render_state);
+    auto mvp = proj_mat * view_mat * model_mat;
+    flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+    render_state.set_texture(0, battletex);
+    render_state.draw_mesh(spriteobj);
+
+    model_mat = glm::scale(glm::mat4(1.f), {32.f,32.f,1.f});
+
+    {
+        auto mat = glm::translate(model_mat, {baddy->player_pos.x,baddy->player_pos.y,0.5});
+        auto mvp = proj_mat * view_mat * mat;
+        flat_pass.set_transform(render_state, mvp, mat, view_mat);
+        render_state.set_texture(0, playertex);
+        render_state.draw_mesh(spriteobj);
+    }
+
+    for (auto& b : baddy->bullets) {
+        auto mat = glm::translate(model_mat, {b.pos.x,b.pos.y,0.5});
+        auto mvp = proj_mat * view_mat * mat;
+        flat_pass.set_transform(render_state, mvp, mat, view_mat);
+        render_state.set_texture(0, daggertex);
+        render_state.draw_mesh(spriteobj);
+    }
+}
+
+void Game::state_title(double delta) {
+    auto w = float(winwidth);
+    auto h = float(winheight);
+    proj_mat = glm::ortho(-w/2.f,w/2.f,-h/2.f,h/2.f,-1.f,1.f);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+    view_mat = glm::mat4();
+    auto model_mat = glm::scale(glm::mat4(1.f), {h*4.f/3.f/2.f,h/2.f,1.f});
+    flat_pass.bind(render_state);
+    auto mvp = proj_mat * view_mat * model_mat;
+    flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+    render_state.set_texture(0, titletex);
+    render_state.draw_mesh(spriteobj);
+
+    if (input.was_pressed(Button::LEFT) || input.was_pressed(Button::RIGHT)) {
+        cur_state = state_moving;
+        ui_state = nullptr;
+        hud_state = render_hud;
+        history.begin_run(std::uint32_t(run_count), run_seed, room_record(*cur_hall));
+    }
+}
+
+void Game::state_gameover(double delta) {
+    auto w = float(winwidth);
+    auto h = float(winheight);
+    proj_mat = glm::ortho(-w/2.f,w/2.f,-h/2.f,h/2.f,-1.f,1.f);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+    view_mat = glm::mat4();
+    auto model_mat = glm::scale(glm::mat4(1.f), {h*4.f/3.f/2.f,h/2.f,1.f});
+    flat_pass.bind(render_state);
+    auto mvp = proj_mat * view_mat * model_mat;
+    flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+    render_state.set_texture(0, gameovertex);
+    render_state.draw_mesh(spriteobj);
+}
+
+void Game::render_hud() {
+    proj_mat = glm::ortho(0.f,float(winwidth),float(winheight),0.f,-1.f,1.f);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+    view_mat = glm::mat4();
+    auto model_mat = glm::scale(glm::mat4(1.f), {32.f,-32.f,1.f});
+    model_mat = glm::translate(model_mat, {1.f,-1.f,0.f});
+    flat_pass.bind(render_state);
+    for (int i=0; i<player_health; ++i) {
+        auto mvp = proj_mat * view_mat * model_mat;
+        flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+        render_state.set_texture(0, hearttex);
+        render_state.draw_mesh(spriteobj);
+        model_mat = glm::translate(model_mat, {2.f,0.f,0.f});
+    }
+    proj_mat = glm::ortho(0.f,float(winwidth),0.f,float(winheight),-1.f,1.f);
+    render_state.clear(GL_DEPTH_BUFFER_BIT);
+    view_mat = glm::mat4();
+    model_mat = glm::scale(glm::mat4(1.f), {32.f,32.f,1.f});
+    model_mat = glm::translate(model_mat, {1.f,1.f,0.f});
+    flat_pass.bind(render_state);
+    for (auto item : player_items) {
+        auto mvp = proj_mat * view_mat * model_mat;
+        flat_pass.set_transform(render_state, mvp, model_mat, view_mat);
+        render_state.set_texture(0, itemtexs[int(item)]);
+        render_state.draw_mesh(spriteobj);
+        model_mat = glm::translate(model_mat, {2.f,0.f,0.f});
+    }
+
+    if (show_metrics) {
+        render_metrics_overlay();
+    }
+}
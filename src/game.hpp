@@ -0,0 +1,391 @@
+#ifndef LD34_GAME_HPP
+#define LD34_GAME_HPP
+
+#include "util.hpp"
+#include "render_state.hpp"
+#include "input.hpp"
+#include "random.hpp"
+#include "collision.hpp"
+#include "lighting.hpp"
+#include "metrics.hpp"
+#include "debug_font.hpp"
+#include "mesh.hpp"
+#include "impostor.hpp"
+#include "history.hpp"
+#include "music_stream.hpp"
+#include "render_pass.hpp"
+#include "post_process.hpp"
+
+#include <sushi/sushi.hpp>
+#include <soloud.h>
+#include <soloud_wav.h>
+#include <soloud_speech.h>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <boost/variant.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Every random decision draws from its own Philox stream keyed off the run seed,
+// so the whole run is determined by this seed and the input, which is what makes input logs replayable.
+enum class Stream : std::uint64_t {
+    HALLS,
+    BATTLES,
+    EFFECTS
+};
+
+// Keys every stream off seed; call before the first hall is made.
+void seed_rng(std::uint64_t seed);
+
+struct Nothing {};
+
+enum class Item {
+    TORCH,
+    BOOTS,
+    HEAL,
+    NUM_ITEMS,
+    MIMIC
+};
+
+struct Treasure {
+    Item item;
+};
+
+enum class BaddyType {
+    BAD_DUDE,
+    MIMIC
+};
+struct Baddy {
+    BaddyType type = BaddyType::BAD_DUDE;
+};
+
+struct Hallway {
+    int len;
+    boost::variant<Nothing,Treasure,Baddy> inhabitant;
+    std::shared_ptr<Hallway> left;
+    std::shared_ptr<Hallway> right;
+
+    enum Dir {
+        NONE,
+        LEFT,
+        RIGHT
+    };
+
+    Dir from = NONE;
+    std::uint64_t id = 0;
+    int depth = 0;
+
+    InstanceCount<Hallway> instance_count;
+};
+
+struct Config {
+    int AA = 2;
+    bool anisotropic = true;
+    int extra_lights = 0;
+    int lookahead = 4;
+    int segment_budget = 48;
+};
+
+extern Config config;
+
+struct Game {
+    static constexpr auto player_speed = 2.f;
+    static constexpr auto battle_speed = 12.5f;
+    static constexpr auto fov = 120.f;
+
+    // Lookahead: halls this deep are drawn segment by segment, deeper ones as one stretched segment,
+    // and subtrees past config.lookahead or the segment budget as impostors.
+    static constexpr auto full_detail_depth = 2;
+    static constexpr auto impostor_depth = 3;
+    static constexpr auto impostor_eye_distance = 4.f;
+    static constexpr auto max_impostor_renders = 2;
+
+    using State = void(Game::*)(double);
+    State cur_state = nullptr;
+    State ui_state = nullptr;
+    using HudState = void(Game::*)();
+    HudState hud_state = nullptr;
+
+    int player_health = 3;
+    int difficulty = 1;
+    std::vector<Item> player_items = {};
+
+    glm::vec3 player_pos = {0.f, 0.f, 0.f};
+    glm::quat player_rot = glm::quat();
+
+    sushi::texture_2d halltex = sushi::load_texture_2d("assets/textures/hallway.png", false, false, config.anisotropic);
+    IndexedMesh hallobj = load_optimized_mesh("assets/models/hallway.obj");
+    IndexedMesh juncobj = load_optimized_mesh("assets/models/junction.obj");
+
+    // The world is drawn lit, or flat while FULLBRIGHT is held; sprites, impostors and the HUD are always flat.
+    LitPass lit_pass;
+    FlatPass flat_pass;
+    FisheyePass fisheye_pass;
+    bool world_lit = true;
+
+    GpuTimer world_timer;
+    GpuTimer blit_timer;
+    GpuTimer ui_timer;
+
+    sushi::static_mesh spriteobj = sushi::load_static_mesh_data(
+        {{-1,1,0},{1,1,0},{-1,-1,0},{1,-1,0}},
+        {{0,0,1}},
+        {{0,0},{1,0},{0,1},{1,1}},
+        {{{{0,0,0},{1,0,1},{2,0,2}}},{{{2,0,2},{1,0,1},{3,0,3}}}}
+    );
+
+    std::array<sushi::texture_2d,int(Item::NUM_ITEMS)> itemtexs = {{
+        sushi::load_texture_2d("assets/textures/lamp.png", false, false, false),
+        sushi::load_texture_2d("assets/textures/boots.png", false, false, false),
+        sushi::load_texture_2d("assets/textures/heal.png", false, false, false),
+    }};
+
+    IndexedMesh treasureobj = load_optimized_mesh("assets/models/treasure.obj");
+    sushi::texture_2d treasuretex = sushi::load_texture_2d("assets/textures/treasure.png", false, false, config.anisotropic);
+
+    sushi::texture_2d baddytex = sushi::load_texture_2d("assets/textures/baddy.png", false, false, config.anisotropic);
+    sushi::texture_2d mimictex = sushi::load_texture_2d("assets/textures/mimic.png", false, false, config.anisotropic);
+    sushi::texture_2d hearttex = sushi::load_texture_2d("assets/textures/heart.png", false, false, false);
+    sushi::texture_2d battletex = sushi::load_texture_2d("assets/textures/battle.png", false, false, false);
+    sushi::texture_2d playertex = sushi::load_texture_2d("assets/textures/player.png", false, false, false);
+    sushi::texture_2d daggertex = sushi::load_texture_2d("assets/textures/dagger.png", false, false, false);
+
+    sushi::texture_2d titletex = sushi::load_texture_2d("assets/textures/title.png", false, false, false);
+    sushi::texture_2d gameovertex = sushi::load_texture_2d("assets/textures/gameover.png", false, false, false);
+
+    std::shared_ptr<Hallway> cur_hall;
+    std::uint64_t run_count = 0;
+    std::uint64_t tree_version = 0;
+
+    glm::mat4 proj_mat;
+    glm::mat4 view_mat;
+
+    sushi::window* window;
+    InputState input;
+    bool quit = false;
+
+    RenderState render_state;
+
+    LightSource lamp = LightSource(2.5, 5);
+    LightFlicker flicker = LightFlicker(256);
+    LightClusters light_clusters;
+    std::vector<PointLight> lights;
+
+    // One hall of the lookahead, in the order it will be drawn.
+    struct HallDraw {
+        enum Detail {
+            FULL,
+            SIMPLE,
+            IMPOSTOR,
+            STUB,
+            HIDDEN,
+            NUM_DETAILS
+        };
+
+        Hallway* hall;
+        glm::mat4 model_mat;
+        Detail detail;
+        const sushi::texture_2d* impostor = nullptr;
+    };
+    std::vector<HallDraw> hall_draws;
+    std::vector<HallDraw> impostor_draws;
+    ImpostorCache impostors = ImpostorCache(32);
+    LightClusters impostor_clusters;
+
+    MetricsRegistry metrics;
+
+    // The metrics that are touched every frame, looked up once so that recording them costs no map lookups.
+    struct FrameMetrics {
+        explicit FrameMetrics(MetricsRegistry& metrics);
+
+        Counter& frames;
+        Counter& impostor_renders;
+        std::vector<Counter*> state_us; // By state_index
+
+        Histogram& frame_time_us;
+        Histogram& draw_calls_hist;
+        Histogram& uniform_uploads_hist;
+        Histogram& texture_binds_hist;
+        Histogram& gpu_world_us;
+        Histogram& gpu_blit_us;
+        Histogram& gpu_ui_us;
+        Histogram& cpu_resolve_us;
+        Histogram& input_latency_us;
+
+        Gauge& frame_time_ms;
+        Gauge& draw_calls;
+        Gauge& uniform_uploads;
+        Gauge& uniform_uploads_elided;
+        Gauge& texture_binds;
+        Gauge& texture_binds_elided;
+        Gauge& lights;
+        Gauge& bullets_alive;
+        Gauge& halls_allocated;
+        Gauge& audio_voices;
+        Gauge& halls_full;
+        Gauge& halls_simple;
+        Gauge& halls_impostor;
+        Gauge& halls_stub;
+        Gauge& halls_hidden;
+        Gauge& impostor_hits;
+        Gauge& gpu_world_ms;
+        Gauge& gpu_blit_ms;
+        Gauge& gpu_ui_ms;
+        Gauge& music_underruns;
+        Gauge& music_decode_ms;
+        Gauge& music_decode_max_ms;
+        Gauge& music_buffer_fill;
+    };
+    FrameMetrics frame_metrics = FrameMetrics(metrics);
+    RunHistory history;
+    DebugFont font;
+    bool show_metrics = false;
+
+    struct BaddyState {
+        float countdown = 0.5f;
+        struct Bullet {
+            glm::vec2 pos;
+            bool alive = true;
+        };
+        std::vector<Bullet> bullets = {};
+        glm::vec2 player_pos = {0.f,-7.f};
+        Philox rng;
+    };
+
+    std::shared_ptr<BaddyState> baddy;
+
+    struct TreasureState {
+        Treasure treasure;
+        float timer = 1.f;
+    };
+    std::shared_ptr<TreasureState> treasure_state;
+
+    int winwidth;
+    int winheight;
+
+    // The texture we're going to render to
+    sushi::texture_2d renderedTexture = {sushi::make_unique_texture(),0,0};
+    GLuint framebuffer = 0;
+    GLuint depthrenderbuffer = 0;
+
+    // Set on software renderers, which would otherwise push the fisheye blit through their own rasterizer;
+    // see resolve_on_cpu.
+    std::unique_ptr<FisheyeResolve> cpu_resolve;
+    Image resolve_src;
+    Image resolve_dst;
+    sushi::texture_2d resolved_texture = {sushi::make_unique_texture(),0,0};
+
+    SoLoud::Soloud* soloud;
+    BufferedStream* music = nullptr;
+
+    SoLoud::Wav hurtsfx;
+    SoLoud::Wav misssfx;
+    SoLoud::Speech itemsfx;
+
+    bool player_lost = false;
+
+    Game(sushi::window* window, SoLoud::Soloud* soloud);
+    void reset();
+
+    // Sized for config.AA; called again whenever that changes.
+    void create_framebuffer();
+    float get_run_speed();
+    void bind_world_pass();
+    void set_world_transform(const glm::mat4& mvp, const glm::mat4& model_mat);
+    glm::mat4 draw_hallway(const Hallway& hall, glm::mat4 model_mat);
+
+    // Far halls: one segment stretched over the whole length, then the end junction.
+    glm::mat4 draw_hallway_simple(const Hallway& hall, const glm::mat4& model_mat);
+    void draw_inhabitant(const Hallway& hall, const glm::mat4& model_mat);
+
+    // The impostor was rendered looking straight into the hall's entrance, so it goes on a quad over the opening.
+    // Its lighting is baked in, so it is drawn with the flat pass.
+    void draw_impostor(const sushi::texture_2d& texture, const glm::mat4& model_mat);
+    void draw_planned_hallway(const HallDraw& draw);
+
+    // Children are generated when lookahead first reaches them. Their contents only depend on their id and depth,
+    // so how far ahead that happens makes no difference to the run.
+    void ensure_children(Hallway& hall);
+
+    // Everything past a hall is seen through its 2x2 entrance, so if that is off screen the whole subtree is.
+    bool entrance_visible(const glm::mat4& model_mat) const;
+
+    // Breadth first, so that when the segment budget runs out it is the farthest halls that become impostors.
+    // Without impostors, the frontier gets placeholder halls like it always did. Halls behind an off screen entrance
+    // still light the halls around them, but are neither drawn nor expanded.
+    void plan_hallways(Hallway& root, const glm::mat4& model_mat, int full_depth, int max_depth, int budget, bool use_impostors, std::vector<HallDraw>& out);
+
+    // Lights are found from the same plan as the geometry; slot 0 of the flicker bank is the lamp.
+    int flicker_slot(std::uint64_t key);
+    void gather_hallway_lights(const Hallway& hall, const glm::mat4& model_mat);
+    void gather_planned_lights(const std::vector<HallDraw>& draws);
+    void set_lamp_uniforms();
+
+    // Renders the subtree at hall, in its own space, as seen from impostor_eye_distance in front of its entrance.
+    // The frustum's near plane is exactly the 2x2 opening, which is where draw_impostor puts the result.
+    void render_impostor(ImpostorCache::Slot& slot, Hallway& hall);
+    void draw_world(const glm::mat4& model_mat);
+    void main_loop(double delta);
+    void begin_world_pass();
+    void blit_world(bool fisheye);
+
+    // Reads the world back and leaves it fisheyed and downsampled in resolved_texture, bound to unit 0,
+    // for blit_world to draw flat. The framebuffer's pending clear was flushed when blit_world switched away.
+    void resolve_on_cpu(bool fisheye);
+
+    // Textures are loaded with config.anisotropic; this brings the world textures in line after it changes.
+    void apply_anisotropy();
+
+    // Times the world and blit passes for a fixed scene at each candidate, best looking first, and keeps the
+    // first that fits in target_ms. The scene is the start of the hall a seed of 0 makes, with a treasure in it.
+    // Returns the time measured for the candidate kept.
+    double auto_tune(double target_ms);
+    // States with a name of their own get an index each; every other state shares the one past them.
+    static int state_index(State state);
+    const char* state_name(State state) const;
+
+    // GL counts come from RenderState::last_frame(), so they trail the frame time by one frame.
+    void record_metrics(double frame_time);
+    void draw_text(const std::string& text, float x, float y, float px);
+
+    // Driver-counted vertex shader work per draw, sushi's unindexed meshes against the optimized ones (--mesh-stats).
+    void report_mesh_stats();
+    void render_metrics_overlay();
+
+    // Halls used to be generated one level ahead, as the player entered their parent, so a hall at depth n got the
+    // difficulty the player had at depth n-1. That still holds however far ahead lookahead generates it.
+    std::shared_ptr<Hallway> make_random_hall(std::uint64_t id, int depth);
+    static RoomRecord room_record(const Hallway& hall);
+    Treasure make_random_treasure(Philox& rng);
+
+    struct LoseTimer {
+        float timer = 1.f;
+    };
+    std::shared_ptr<LoseTimer> losetimer;
+
+    void state_lose(double delta);
+    void state_moving(double delta);
+    void state_tojunc(double delta);
+    void state_turnleft(double delta);
+    void state_turnright(double delta);
+    void state_whichway(double delta);
+    void state_treasure(double delta);
+    void state_treasure_get(double delta);
+    void start_battle();
+    void state_baddy(double delta);
+
+    // Everything state_baddy does besides drawing the world, so that it can be measured on its own.
+    void update_battle(double delta);
+    void state_battlewin(double delta);
+    void baddy_ui_state(double delta);
+    void state_title(double delta);
+    void state_gameover(double delta);
+    void render_hud();
+};
+
+#endif //LD34_GAME_HPP
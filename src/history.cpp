@@ -0,0 +1,97 @@
+#include "history.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+constexpr std::size_t RunHistory::CHUNK_WORDS;
+
+namespace history_log {
+
+std::uint32_t pack_room(const RoomRecord& room) {
+    auto len = std::uint32_t(std::min(std::max(room.len, 0), 0xFF));
+    auto damage = std::uint32_t(std::min(std::max(room.damage, 0), 0xF));
+    return TAG_ROOM
+        | len << 2
+        | std::uint32_t(room.contents) << 10
+        | std::uint32_t(room.choice) << 13
+        | damage << 15
+        | std::uint32_t(room.item) << 19;
+}
+
+RoomRecord unpack_room(std::uint32_t word) {
+    auto rv = RoomRecord();
+    rv.len = int(word >> 2 & 0xFF);
+    rv.contents = RoomContents(word >> 10 & 0x7);
+    rv.choice = RoomChoice(word >> 13 & 0x3);
+    rv.damage = int(word >> 15 & 0xF);
+    rv.item = RoomItem(word >> 19 & 0x3);
+    return rv;
+}
+
+}
+
+RunHistory::RunHistory() {
+    chunks.push_back(std::make_unique<Chunk>());
+}
+
+void RunHistory::stream_to(const std::string& fname) {
+    file.open(fname, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open history log " + fname + " for writing!");
+    }
+    file.write(history_log::MAGIC, sizeof(history_log::MAGIC));
+    file.write(reinterpret_cast<const char*>(&history_log::VERSION), sizeof(history_log::VERSION));
+
+    // From here on only the last chunk is kept.
+    for (std::size_t i=0; i+1<chunks.size(); ++i) {
+        file.write(reinterpret_cast<const char*>(chunks[i]->data()), CHUNK_WORDS * sizeof(std::uint32_t));
+    }
+    chunks.erase(begin(chunks), end(chunks) - 1);
+    written = 0;
+    flush();
+}
+
+void RunHistory::flush() {
+    if (!file.is_open()) {
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(chunks.back()->data() + written), (used - written) * sizeof(std::uint32_t));
+    file.flush();
+    written = used;
+}
+
+void RunHistory::append(std::uint32_t word) {
+    if (used == CHUNK_WORDS) {
+        if (file.is_open()) {
+            flush();
+        } else {
+            chunks.push_back(std::make_unique<Chunk>());
+        }
+        used = 0;
+        written = 0;
+    }
+    (*chunks.back())[used++] = word;
+}
+
+void RunHistory::begin_run(std::uint32_t run_number, std::uint64_t seed, const RoomRecord& first_room) {
+    append(history_log::TAG_BEGIN | run_number << 2);
+    append(std::uint32_t(seed));
+    append(std::uint32_t(seed >> 32));
+    running = true;
+    cur_room = first_room;
+}
+
+void RunHistory::next_room(RoomChoice choice, const RoomRecord& room) {
+    cur_room.choice = choice;
+    append(history_log::pack_room(cur_room));
+    ++rooms;
+    cur_room = room;
+}
+
+void RunHistory::end_run(RunEnd reason, int difficulty) {
+    cur_room.choice = RoomChoice::NONE;
+    append(history_log::pack_room(cur_room));
+    ++rooms;
+    append(history_log::TAG_END | std::uint32_t(reason) << 2 | std::uint32_t(std::min(std::max(difficulty, 0), 0xFFFF)) << 4);
+    running = false;
+}
@@ -0,0 +1,104 @@
+#ifndef LD34_HISTORY_HPP
+#define LD34_HISTORY_HPP
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// What a room held when the player walked into it.
+enum class RoomContents : std::uint8_t {
+    EMPTY,
+    TORCH,
+    BOOTS,
+    HEAL,
+    MIMIC,
+    BADDY
+};
+
+enum class RoomChoice : std::uint8_t {
+    NONE, // The run ended in this room
+    LEFT,
+    RIGHT
+};
+
+enum class RoomItem : std::uint8_t {
+    NONE,
+    TORCH,
+    BOOTS,
+    HEAL
+};
+
+enum class RunEnd : std::uint8_t {
+    QUIT,
+    LOST
+};
+
+struct RoomRecord {
+    int len = 0;
+    RoomContents contents = RoomContents::EMPTY;
+    RoomChoice choice = RoomChoice::NONE;
+    int damage = 0;
+    RoomItem item = RoomItem::NONE;
+};
+
+// History log format (little endian):
+//   header: "DOCH", u32 version
+//   then u32 words, told apart by their low two bits:
+//     TAG_ROOM:  bits 2-9 length, 10-12 RoomContents, 13-14 RoomChoice, 15-18 damage, 19-20 RoomItem
+//     TAG_BEGIN: bits 2-31 run number, then two words of run seed, low word first
+//     TAG_END:   bits 2-3 RunEnd, bits 4-19 difficulty reached
+// Lengths and damage saturate at their field's maximum.
+namespace history_log {
+    constexpr char MAGIC[4] = {'D','O','C','H'};
+    constexpr std::uint32_t VERSION = 1;
+    constexpr std::uint32_t TAG_MASK = 0x3;
+    constexpr std::uint32_t TAG_ROOM = 0;
+    constexpr std::uint32_t TAG_BEGIN = 1;
+    constexpr std::uint32_t TAG_END = 2;
+
+    std::uint32_t pack_room(const RoomRecord& room);
+    RoomRecord unpack_room(std::uint32_t word);
+}
+
+// Every room of every run, four bytes each, appended to fixed-size chunks so that recording a room never allocates.
+// When streaming, full chunks go to disk and are reused; otherwise the whole session stays in memory.
+class RunHistory {
+public:
+    static constexpr std::size_t CHUNK_WORDS = 16384;
+
+    RunHistory();
+
+    // Writes everything recorded so far, then keeps the file up to date at each flush.
+    void stream_to(const std::string& fname);
+    void flush();
+
+    void begin_run(std::uint32_t run_number, std::uint64_t seed, const RoomRecord& first_room);
+    void end_run(RunEnd reason, int difficulty);
+    bool in_run() const { return running; }
+
+    // The room the player is in; only valid during a run.
+    RoomRecord& room() { return cur_room; }
+    void next_room(RoomChoice choice, const RoomRecord& room);
+
+    std::uint64_t num_rooms() const { return rooms; }
+    std::size_t num_chunks() const { return chunks.size(); }
+
+private:
+    using Chunk = std::array<std::uint32_t, CHUNK_WORDS>;
+
+    void append(std::uint32_t word);
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::size_t used = 0;    // Words used in the last chunk
+    std::size_t written = 0; // Words of the last chunk already in the file
+
+    std::ofstream file;
+    bool running = false;
+    RoomRecord cur_room;
+    std::uint64_t rooms = 0;
+};
+
+#endif //LD34_HISTORY_HPP
@@ -0,0 +1,112 @@
+#include "history.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+// Summarizes a history log written with --history.
+// Usage: history_reader <log>
+int main(int argc, char* argv[]) try {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <history log>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto file = std::ifstream(argv[1], std::ios::binary);
+    if (!file) {
+        throw std::runtime_error(std::string("Failed to open ") + argv[1] + "!");
+    }
+    char magic[4];
+    std::uint32_t version = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!file || !std::equal(magic, magic + 4, history_log::MAGIC)) {
+        throw std::runtime_error(std::string(argv[1]) + " is not a history log!");
+    }
+    if (version != history_log::VERSION) {
+        throw std::runtime_error(std::string(argv[1]) + " has an unsupported history log version!");
+    }
+
+    std::uint64_t runs = 0;
+    std::uint64_t runs_lost = 0;
+    std::uint64_t rooms = 0;
+    std::uint64_t total_len = 0;
+    std::uint64_t total_damage = 0;
+    std::uint64_t contents[6] = {};
+    std::uint64_t choices[3] = {};
+    std::uint64_t items[4] = {};
+    std::uint64_t run_rooms = 0;
+    std::uint64_t longest_run = 0;
+    int max_difficulty = 0;
+
+    // Words still owed to a TAG_BEGIN, which are the seed and not records.
+    auto skip = 0;
+
+    std::vector<std::uint32_t> block(1 << 18);
+    while (file) {
+        file.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(std::uint32_t));
+        auto n = std::size_t(file.gcount()) / sizeof(std::uint32_t);
+        for (std::size_t i=0; i<n; ++i) {
+            auto word = block[i];
+            if (skip > 0) {
+                --skip;
+                continue;
+            }
+            switch (word & history_log::TAG_MASK) {
+                case history_log::TAG_ROOM: {
+                    auto room = history_log::unpack_room(word);
+                    ++rooms;
+                    ++run_rooms;
+                    total_len += room.len;
+                    total_damage += room.damage;
+                    ++contents[std::min(int(room.contents), 5)];
+                    ++choices[std::min(int(room.choice), 2)];
+                    ++items[int(room.item)];
+                } break;
+                case history_log::TAG_BEGIN:
+                    ++runs;
+                    run_rooms = 0;
+                    skip = 2;
+                    break;
+                case history_log::TAG_END:
+                    if (RunEnd(word >> 2 & 0x3) == RunEnd::LOST) {
+                        ++runs_lost;
+                    }
+                    max_difficulty = std::max(max_difficulty, int(word >> 4 & 0xFFFF));
+                    longest_run = std::max(longest_run, run_rooms);
+                    break;
+                default:
+                    throw std::runtime_error("Unknown record in history log!");
+            }
+        }
+    }
+    longest_run = std::max(longest_run, run_rooms);
+
+    auto pct = [&](std::uint64_t n) {
+        return rooms ? 100.0 * n / rooms : 0.0;
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "runs " << runs << " (" << runs_lost << " lost)" << std::endl;
+    std::cout << "rooms " << rooms << ", " << (runs ? double(rooms) / runs : 0.0) << " per run, longest run " << longest_run << std::endl;
+    std::cout << "max difficulty " << max_difficulty << std::endl;
+    std::cout << "mean length " << (rooms ? double(total_len) / rooms : 0.0) << std::endl;
+    std::cout << "damage taken " << total_damage << ", " << (rooms ? double(total_damage) / rooms : 0.0) << " per room" << std::endl;
+    std::cout << "contents: empty " << pct(contents[0]) << "%, torch " << pct(contents[1]) << "%, boots " << pct(contents[2])
+              << "%, heal " << pct(contents[3]) << "%, mimic " << pct(contents[4]) << "%, baddy " << pct(contents[5]) << "%" << std::endl;
+    std::cout << "choices: left " << choices[1] << ", right " << choices[2] << ", ended " << choices[0] << std::endl;
+    std::cout << "items: torch " << items[1] << ", boots " << items[2] << ", heal " << items[3] << std::endl;
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::clog << "Read " << rooms << " rooms in " << elapsed * 1000.0 << "ms" << std::endl;
+
+    return EXIT_SUCCESS;
+} catch (const std::exception& e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
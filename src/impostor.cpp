@@ -0,0 +1,102 @@
+#include "impostor.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+constexpr int ImpostorCache::SIZE;
+
+ImpostorCache::ImpostorCache(int num_slots) : slots(num_slots) {
+    for (auto& slot : slots) {
+        slot.texture = {sushi::make_unique_texture(), SIZE, SIZE};
+        glBindTexture(GL_TEXTURE_2D, slot.texture.handle.get());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SIZE, SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &slot.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, slot.framebuffer);
+
+        glGenRenderbuffers(1, &slot.depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, slot.depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SIZE, SIZE);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, slot.depth);
+
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, slot.texture.handle.get(), 0);
+        GLenum draw_buffers[1] = {GL_COLOR_ATTACHMENT0};
+        glDrawBuffers(1, draw_buffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Failed to create impostor framebuffer!");
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// The slots' framebuffers and renderbuffers belong to whichever cache holds the slots, so a moved-from cache
+// is left with none to delete.
+ImpostorCache::ImpostorCache(ImpostorCache&& other) noexcept :
+    slots(std::move(other.slots)),
+    num_hits(other.num_hits),
+    num_misses(other.num_misses) {
+    other.slots.clear();
+}
+
+ImpostorCache& ImpostorCache::operator=(ImpostorCache&& other) noexcept {
+    std::swap(slots, other.slots);
+    num_hits = other.num_hits;
+    num_misses = other.num_misses;
+    return *this;
+}
+
+ImpostorCache::~ImpostorCache() {
+    for (auto& slot : slots) {
+        glDeleteFramebuffers(1, &slot.framebuffer);
+        glDeleteRenderbuffers(1, &slot.depth);
+    }
+}
+
+void ImpostorCache::begin_frame() {
+    for (auto& slot : slots) {
+        if (!slot.used) {
+            slot.valid = false;
+        }
+        slot.used = false;
+    }
+    num_hits = 0;
+    num_misses = 0;
+}
+
+const sushi::texture_2d* ImpostorCache::find(std::uint64_t key, std::uint64_t version) {
+    for (auto& slot : slots) {
+        if (slot.valid && slot.key == key && slot.version == version) {
+            slot.used = true;
+            ++num_hits;
+            return &slot.texture;
+        }
+    }
+    return nullptr;
+}
+
+ImpostorCache::Slot* ImpostorCache::acquire(std::uint64_t key, std::uint64_t version) {
+    ++num_misses;
+    Slot* victim = nullptr;
+    for (auto& slot : slots) {
+        if (slot.used) {
+            continue;
+        }
+        // Prefer empty slots; the others hold last frame's renders, which may still be asked for this frame.
+        if (!victim || (victim->valid && !slot.valid)) {
+            victim = &slot;
+        }
+    }
+    if (victim) {
+        victim->key = key;
+        victim->version = version;
+        victim->valid = true;
+        victim->used = true;
+    }
+    return victim;
+}
@@ -0,0 +1,48 @@
+#ifndef LD34_IMPOSTOR_HPP
+#define LD34_IMPOSTOR_HPP
+
+#include <sushi/sushi.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Small offscreen renders of far subtrees, drawn as a single quad over the subtree's entrance.
+// A slot is kept for as long as its subtree stays on the frontier and the version it was rendered at still holds;
+// slots not asked for during a frame are handed out again the next.
+class ImpostorCache {
+public:
+    static constexpr int SIZE = 128;
+
+    explicit ImpostorCache(int num_slots);
+    ImpostorCache(ImpostorCache&& other) noexcept;
+    ImpostorCache& operator=(ImpostorCache&& other) noexcept;
+    ~ImpostorCache();
+
+    struct Slot {
+        sushi::texture_2d texture;
+        GLuint framebuffer = 0;
+        GLuint depth = 0;
+        std::uint64_t key = 0;
+        std::uint64_t version = 0;
+        bool valid = false;
+        bool used = false;
+    };
+
+    void begin_frame();
+
+    // The cached render for key at version, or nullptr.
+    const sushi::texture_2d* find(std::uint64_t key, std::uint64_t version);
+
+    // A slot to render key into, or nullptr if every slot is already in use this frame.
+    Slot* acquire(std::uint64_t key, std::uint64_t version);
+
+    int hits() const { return num_hits; }
+    int misses() const { return num_misses; }
+
+private:
+    std::vector<Slot> slots;
+    int num_hits = 0;
+    int num_misses = 0;
+};
+
+#endif //LD34_IMPOSTOR_HPP
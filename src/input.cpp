@@ -0,0 +1,243 @@
+#include "input.hpp"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+static const sushi::input_button button_map[int(Button::NUM_BUTTONS)] = {
+    {sushi::input_type::KEYBOARD, GLFW_KEY_LEFT},
+    {sushi::input_type::KEYBOARD, GLFW_KEY_RIGHT},
+    {sushi::input_type::KEYBOARD, GLFW_KEY_ESCAPE},
+    {sushi::input_type::KEYBOARD, GLFW_KEY_F5},
+    {sushi::input_type::KEYBOARD, GLFW_KEY_F6},
+    {sushi::input_type::KEYBOARD, GLFW_KEY_F7},
+    {sushi::input_type::KEYBOARD, GLFW_KEY_F8},
+};
+
+InputState poll_input(sushi::window& window) {
+    auto rv = InputState();
+    for (int i=0; i<int(Button::NUM_BUTTONS); ++i) {
+        if (window.is_down(button_map[i])) {
+            rv.down |= 1 << i;
+        }
+        if (window.was_pressed(button_map[i])) {
+            rv.pressed |= 1 << i;
+        }
+    }
+    return rv;
+}
+
+bool InputState::is_down_at(Button b, float offset) const {
+    auto rv = is_down(b);
+    for (auto iter = edges.rbegin(); iter != edges.rend() && iter->offset > offset; ++iter) {
+        if (iter->button == b) {
+            rv = !iter->down;
+        }
+    }
+    return rv;
+}
+
+static const struct {
+    Button button;
+    int vkey;
+} watched_keys[] = {
+    {Button::LEFT, VK_LEFT},
+    {Button::RIGHT, VK_RIGHT},
+};
+
+InputThread::InputThread() : running(true), thread([this]{ run(); }) {}
+
+bool InputThread::watches(Button b) {
+    return std::any_of(std::begin(watched_keys), std::end(watched_keys), [&](auto& key){ return key.button == b; });
+}
+
+InputThread::~InputThread() {
+    running = false;
+    thread.join();
+}
+
+void InputThread::run() {
+    // Sleep(1) only sleeps for a millisecond with the timer resolution turned up.
+    timeBeginPeriod(1);
+    std::uint8_t held = 0;
+    while (running) {
+        // GetAsyncKeyState sees every key on the desktop, so only listen while one of our windows has focus.
+        DWORD pid = 0;
+        GetWindowThreadProcessId(GetForegroundWindow(), &pid);
+        auto focused = (pid == GetCurrentProcessId());
+
+        auto now = clock::now();
+        for (auto& key : watched_keys) {
+            auto bit = std::uint8_t(1 << int(key.button));
+            auto is_held = focused && (GetAsyncKeyState(key.vkey) & 0x8000);
+            if (is_held != bool(held & bit)) {
+                held ^= bit;
+                std::lock_guard<std::mutex> lock (mutex);
+                events.push_back({key.button, is_held, now});
+            }
+        }
+        Sleep(1);
+    }
+    timeEndPeriod(1);
+}
+
+void InputThread::collect(clock::time_point tick_start, clock::time_point tick_end, InputState& state) {
+    // The window saw the same presses, a frame late; counting them too would press the key twice.
+    for (auto& key : watched_keys) {
+        auto bit = std::uint8_t(1 << int(key.button));
+        state.pressed &= ~bit;
+    }
+
+    std::lock_guard<std::mutex> lock (mutex);
+    auto iter = begin(events);
+    for (; iter != end(events) && iter->time <= tick_end; ++iter) {
+        auto bit = std::uint8_t(1 << int(iter->button));
+        auto offset = std::max(std::chrono::duration<float>(iter->time - tick_start).count(), 0.f);
+        state.edges.push_back({iter->button, iter->down, offset});
+        if (iter->down) {
+            down |= bit;
+            state.pressed |= bit;
+        } else {
+            down &= ~bit;
+        }
+    }
+    events.erase(begin(events), iter);
+
+    for (auto& key : watched_keys) {
+        auto bit = std::uint8_t(1 << int(key.button));
+        state.down = (state.down & ~bit) | (down & bit);
+    }
+}
+
+template <typename T>
+static void write_raw(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool try_read_raw(std::istream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+static T read_raw(std::istream& in) {
+    T value;
+    if (!try_read_raw(in, value)) {
+        throw std::runtime_error("Input log is truncated!");
+    }
+    return value;
+}
+
+InputRecorder::InputRecorder(const std::string& fname, std::uint64_t seed) : file(fname, std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("Failed to open input log " + fname + " for writing!");
+    }
+    file.write(input_log::MAGIC, sizeof(input_log::MAGIC));
+    write_raw(file, input_log::VERSION);
+    write_raw(file, seed);
+}
+
+InputRecorder::~InputRecorder() {
+    write_raw(file, input_log::END_TAG);
+}
+
+void InputRecorder::record(const InputState& state, double delta) {
+    auto write_edge = [&](int button, bool down, float offset) {
+        write_raw(file, std::uint8_t((down ? input_log::PRESS_BIT : 0) | button));
+        write_raw(file, offset);
+    };
+
+    std::uint8_t timed = 0;
+    for (auto& edge : state.edges) {
+        write_edge(int(edge.button), edge.down, edge.offset);
+        timed |= 1 << int(edge.button);
+    }
+
+    for (int i=0; i<int(Button::NUM_BUTTONS); ++i) {
+        auto bit = std::uint8_t(1 << i);
+        if (timed & bit) {
+            continue;
+        }
+        // A tap shorter than a frame shows up as pressed but not down; it still needs both edges.
+        if (state.pressed & bit || (state.down & bit && !(last_down & bit))) {
+            write_edge(i, true, float(delta));
+        }
+        if (last_down & bit && !(state.down & bit) || state.pressed & bit && !(state.down & bit)) {
+            write_edge(i, false, float(delta));
+        }
+    }
+    last_down = state.down;
+    write_raw(file, input_log::TICK_TAG);
+    write_raw(file, float(delta));
+}
+
+InputReplay::InputReplay(const std::string& fname) {
+    auto file = std::ifstream(fname, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open input log " + fname + "!");
+    }
+
+    char magic[4];
+    file.read(magic, sizeof(magic));
+    if (!file || !std::equal(magic, magic + 4, input_log::MAGIC)) {
+        throw std::runtime_error(fname + " is not an input log!");
+    }
+    auto version = read_raw<std::uint32_t>(file);
+    if (version < 1 || version > input_log::VERSION) {
+        throw std::runtime_error(fname + " has an unsupported input log version!");
+    }
+    run_seed = read_raw<std::uint64_t>(file);
+
+    std::uint8_t down = 0;
+    std::uint8_t pressed = 0;
+    auto first_edge = edges.size();
+    // A log cut short by a crash simply ends at its last complete tick;
+    // whatever was written of the tick after it is dropped.
+    std::uint8_t tag;
+    while (try_read_raw(file, tag) && tag != input_log::END_TAG) {
+        if (tag == input_log::TICK_TAG) {
+            float tick_delta;
+            if (!try_read_raw(file, tick_delta)) {
+                break;
+            }
+            ticks.push_back({down, pressed, first_edge, edges.size(), tick_delta});
+            pressed = 0;
+            first_edge = edges.size();
+        } else {
+            auto button = tag & ~input_log::PRESS_BIT;
+            if (button >= int(Button::NUM_BUTTONS)) {
+                throw std::runtime_error(fname + " has an edge for an unknown button!");
+            }
+            auto bit = std::uint8_t(1 << button);
+            auto is_press = bool(tag & input_log::PRESS_BIT);
+            if (version >= 2) {
+                float offset;
+                if (!try_read_raw(file, offset)) {
+                    break;
+                }
+                edges.push_back({Button(button), is_press, offset});
+            }
+            if (is_press) {
+                down |= bit;
+                pressed |= bit;
+            } else {
+                down &= ~bit;
+            }
+        }
+    }
+    edges.resize(first_edge);
+}
+
+bool InputReplay::next(InputState& state, double& delta) {
+    if (cur >= ticks.size()) {
+        return false;
+    }
+    auto& tick = ticks[cur];
+    state.down = tick.down;
+    state.pressed = tick.pressed;
+    state.edges.assign(begin(edges) + tick.first_edge, begin(edges) + tick.end_edge);
+    delta = tick.delta;
+    ++cur;
+    return true;
+}
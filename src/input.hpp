@@ -0,0 +1,136 @@
+#ifndef LD34_INPUT_HPP
+#define LD34_INPUT_HPP
+
+#include <sushi/sushi.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every button the game reads. The game never talks to the window directly,
+// so a tick's input can come from the keyboard or from a recorded log.
+enum class Button : std::uint8_t {
+    LEFT,
+    RIGHT,
+    ESCAPE,
+    FULLBRIGHT,
+    NO_FISHEYE,
+    FAST_FORWARD,
+    METRICS,
+    NUM_BUTTONS
+};
+
+struct InputEdge {
+    Button button;
+    bool down;
+    float offset; // Seconds from the start of the tick
+};
+
+struct InputState {
+    std::uint8_t down = 0;
+    std::uint8_t pressed = 0;
+
+    // Edges inside the tick, in order, where their timing is known; `down` is the state at the end of the tick.
+    std::vector<InputEdge> edges;
+
+    bool is_down(Button b) const { return down & (1 << int(b)); }
+    bool was_pressed(Button b) const { return pressed & (1 << int(b)); }
+
+    bool is_down_at(Button b, float offset) const;
+};
+
+InputState poll_input(sushi::window& window);
+
+// Polls the dodge keys at about 1kHz on its own thread, so that edges between frames keep their own times
+// instead of all landing on the next frame.
+class InputThread {
+public:
+    using clock = std::chrono::high_resolution_clock;
+
+    InputThread();
+    ~InputThread();
+
+    // Whether b is one of the buttons the thread watches. For those the thread is the only source of input;
+    // whatever poll_input saw of them is replaced in collect.
+    static bool watches(Button b);
+
+    // Moves the edges up to tick_end into state, timed from tick_start, and sets the watched buttons' bits to match.
+    // Later edges wait for the next tick.
+    void collect(clock::time_point tick_start, clock::time_point tick_end, InputState& state);
+
+private:
+    struct Event {
+        Button button;
+        bool down;
+        clock::time_point time;
+    };
+
+    void run();
+
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::atomic<bool> running;
+    std::uint8_t down = 0;
+    std::thread thread;
+};
+
+// Input log format (little endian):
+//   header: "DOCI", u32 version, u64 run seed
+//   then one byte per record:
+//     TICK_TAG followed by the tick's f32 delta, in seconds, before any fast-forward
+//     END_TAG at the end of the log
+//     otherwise an edge: bit 6 set for press, clear for release; low bits are the Button.
+//       Since version 2, followed by its f32 offset into the tick.
+// Edges belong to the tick whose TICK_TAG follows them.
+// Version 1 logs still replay, with every edge at the end of its tick.
+namespace input_log {
+    constexpr char MAGIC[4] = {'D','O','C','I'};
+    constexpr std::uint32_t VERSION = 2;
+    constexpr std::uint8_t TICK_TAG = 0xFF;
+    constexpr std::uint8_t END_TAG = 0xFE;
+    constexpr std::uint8_t PRESS_BIT = 0x40;
+}
+
+class InputRecorder {
+public:
+    InputRecorder(const std::string& fname, std::uint64_t seed);
+    ~InputRecorder();
+
+    void record(const InputState& state, double delta);
+
+private:
+    std::ofstream file;
+    std::uint8_t last_down = 0;
+};
+
+class InputReplay {
+public:
+    explicit InputReplay(const std::string& fname);
+
+    std::uint64_t seed() const { return run_seed; }
+    std::size_t num_ticks() const { return ticks.size(); }
+
+    // Fills in the next tick's input and delta; false once the log is exhausted.
+    bool next(InputState& state, double& delta);
+
+private:
+    struct Tick {
+        std::uint8_t down;
+        std::uint8_t pressed;
+        std::size_t first_edge;
+        std::size_t end_edge;
+        float delta;
+    };
+
+    std::uint64_t run_seed = 0;
+    std::vector<Tick> ticks;
+    std::vector<InputEdge> edges;
+    std::size_t cur = 0;
+};
+
+#endif //LD34_INPUT_HPP
@@ -0,0 +1,181 @@
+#include "lighting.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+
+constexpr int LightClusters::GRID_X;
+constexpr int LightClusters::GRID_Y;
+constexpr int LightClusters::GRID_Z;
+constexpr int LightClusters::NUM_CLUSTERS;
+constexpr int LightClusters::FIRST_UNIT;
+constexpr float LightClusters::NEAR;
+constexpr float LightClusters::FAR;
+
+static constexpr float FLICKER_PERIOD = 0.1f;
+
+LightFlicker::LightFlicker(int num_slots) : bright_flicker(num_slots, 0.f), dim_flicker(num_slots, 0.f), timer(num_slots, 0.f) {
+    // Stagger the timers so the lights don't all jump on the same frame.
+    for (int i=0; i<num_slots; ++i) {
+        timer[i] = FLICKER_PERIOD * i / num_slots;
+    }
+}
+
+void LightFlicker::update(double delta, Philox& rng) {
+    static auto flicker_dist = std::uniform_real_distribution<float>(-.05, .05);
+    auto n = size();
+    auto d = float(delta);
+    for (int i=0; i<n; ++i) {
+        timer[i] += d;
+    }
+    for (int i=0; i<n; ++i) {
+        if (timer[i] >= FLICKER_PERIOD) {
+            bright_flicker[i] = flicker_dist(rng);
+            dim_flicker[i] = flicker_dist(rng);
+            timer[i] = 0;
+        }
+    }
+}
+
+LightClusters::LightClusters() : grid(NUM_CLUSTERS * 2, 0) {
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    for (int i=0; i<3; ++i) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+LightClusters::LightClusters(LightClusters&& other) noexcept :
+    cluster_params(other.cluster_params),
+    light_data(std::move(other.light_data)),
+    grid(std::move(other.grid)),
+    indices(std::move(other.indices)),
+    ranges(std::move(other.ranges)) {
+    for (int i=0; i<3; ++i) {
+        buffers[i] = std::exchange(other.buffers[i], 0);
+        textures[i] = std::exchange(other.textures[i], 0);
+    }
+}
+
+LightClusters::~LightClusters() {
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+}
+
+int LightClusters::slice(float depth) const {
+    if (depth <= NEAR) {
+        return 0;
+    }
+    auto s = 1 + int(std::log(depth / NEAR) * cluster_params.w);
+    return std::min(s, GRID_Z - 1);
+}
+
+void LightClusters::build(const std::vector<PointLight>& lights, const LightFlicker& flicker, float tan_half_fov_x, float tan_half_fov_y) {
+    cluster_params = {tan_half_fov_x, tan_half_fov_y, NEAR, (GRID_Z - 1) / std::log(FAR / NEAR)};
+
+    light_data.clear();
+    ranges.clear();
+    std::fill(begin(grid), end(grid), 0);
+
+    auto tile = [](float u, int n) {
+        return std::min(std::max(int((u * 0.5f + 0.5f) * n), 0), n - 1);
+    };
+
+    // First pass: find the clusters each light's dim sphere touches and count them.
+    for (auto& light : lights) {
+        auto bright = light.source.bright_radius + flicker.bright(light.source.flicker_slot);
+        auto dim = light.source.dim_radius + flicker.dim(light.source.flicker_slot);
+        auto depth = -light.pos.z;
+        auto zmin = depth - dim;
+        auto zmax = depth + dim;
+        if (dim <= 0.f || zmax <= 0.f || zmin >= FAR) {
+            continue;
+        }
+
+        auto r = Range{0, GRID_X - 1, 0, GRID_Y - 1, slice(std::max(zmin, 0.f)), slice(zmax)};
+        // Spheres that reach behind the camera plane cover the whole screen.
+        if (zmin > 0.f) {
+            auto u0 = (light.pos.x - dim) / (zmin * tan_half_fov_x);
+            auto u1 = (light.pos.x + dim) / (zmin * tan_half_fov_x);
+            auto u2 = (light.pos.x - dim) / (zmax * tan_half_fov_x);
+            auto u3 = (light.pos.x + dim) / (zmax * tan_half_fov_x);
+            auto v0 = (light.pos.y - dim) / (zmin * tan_half_fov_y);
+            auto v1 = (light.pos.y + dim) / (zmin * tan_half_fov_y);
+            auto v2 = (light.pos.y - dim) / (zmax * tan_half_fov_y);
+            auto v3 = (light.pos.y + dim) / (zmax * tan_half_fov_y);
+            auto umin = std::min({u0, u1, u2, u3});
+            auto umax = std::max({u0, u1, u2, u3});
+            auto vmin = std::min({v0, v1, v2, v3});
+            auto vmax = std::max({v0, v1, v2, v3});
+            if (umin > 1.f || umax < -1.f || vmin > 1.f || vmax < -1.f) {
+                continue;
+            }
+            r.x0 = tile(umin, GRID_X);
+            r.x1 = tile(umax, GRID_X);
+            r.y0 = tile(vmin, GRID_Y);
+            r.y1 = tile(vmax, GRID_Y);
+        }
+
+        light_data.insert(end(light_data), {light.pos.x, light.pos.y, light.pos.z, bright, dim, 0.f, 0.f, 0.f});
+        ranges.push_back(r);
+
+        for (int z=r.z0; z<=r.z1; ++z) {
+            for (int y=r.y0; y<=r.y1; ++y) {
+                for (int x=r.x0; x<=r.x1; ++x) {
+                    ++grid[((z * GRID_Y + y) * GRID_X + x) * 2 + 1];
+                }
+            }
+        }
+    }
+
+    // Prefix sum into offsets, then scatter the light indices into place.
+    auto total = GLuint(0);
+    for (int c=0; c<NUM_CLUSTERS; ++c) {
+        grid[c * 2] = total;
+        total += grid[c * 2 + 1];
+        grid[c * 2 + 1] = 0;
+    }
+    indices.resize(total);
+    for (int i=0; i<int(ranges.size()); ++i) {
+        auto& r = ranges[i];
+        for (int z=r.z0; z<=r.z1; ++z) {
+            for (int y=r.y0; y<=r.y1; ++y) {
+                for (int x=r.x0; x<=r.x1; ++x) {
+                    auto c = ((z * GRID_Y + y) * GRID_X + x) * 2;
+                    indices[grid[c] + grid[c + 1]++] = GLuint(i);
+                }
+            }
+        }
+    }
+}
+
+void LightClusters::upload(const RenderState& render_state) {
+    if (!render_state.submitting()) {
+        return;
+    }
+    auto upload_buffer = [](GLuint buffer, const void* data, std::size_t size) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        // Orphan last frame's storage instead of waiting on it.
+        glBufferData(GL_TEXTURE_BUFFER, std::max(size, std::size_t(16)), nullptr, GL_STREAM_DRAW);
+        if (size > 0) {
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        }
+    };
+    upload_buffer(buffers[0], light_data.data(), light_data.size() * sizeof(float));
+    upload_buffer(buffers[1], grid.data(), grid.size() * sizeof(GLuint));
+    upload_buffer(buffers[2], indices.data(), indices.size() * sizeof(GLuint));
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind(RenderState& render_state) const {
+    for (int i=0; i<3; ++i) {
+        render_state.set_texture_buffer(FIRST_UNIT + i, textures[i]);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef LD34_LIGHTING_HPP
+#define LD34_LIGHTING_HPP
+
+#include "random.hpp"
+#include "render_state.hpp"
+
+#include <sushi/sushi.hpp>
+
+#include <vector>
+
+struct LightSource {
+    float bright_radius;
+    float dim_radius;
+    int flicker_slot = 0;
+
+    LightSource(float bright_radius, float dim_radius, int flicker_slot = 0) : bright_radius(bright_radius), dim_radius(dim_radius), flicker_slot(flicker_slot) {}
+};
+
+// Flicker state for every light in the dungeon, kept as parallel arrays so that it is updated in one pass.
+// Lights are rebuilt every frame, so they refer to a slot here instead of carrying their own timers.
+class LightFlicker {
+public:
+    explicit LightFlicker(int num_slots);
+
+    int size() const { return int(timer.size()); }
+
+    void update(double delta, Philox& rng);
+
+    float bright(int slot) const { return bright_flicker[slot]; }
+    float dim(int slot) const { return dim_flicker[slot]; }
+
+private:
+    std::vector<float> bright_flicker;
+    std::vector<float> dim_flicker;
+    std::vector<float> timer;
+};
+
+struct PointLight {
+    glm::vec3 pos; // View space
+    LightSource source;
+};
+
+// View-space cluster grid over the perspective frustum, rebuilt on the CPU every frame and handed to the
+// fragment shader as buffer textures so that each fragment only tests the lights that can reach it.
+class LightClusters {
+public:
+    static constexpr int GRID_X = 16;
+    static constexpr int GRID_Y = 8;
+    static constexpr int GRID_Z = 24;
+    static constexpr int NUM_CLUSTERS = GRID_X * GRID_Y * GRID_Z;
+
+    // Texture units used for LightData, LightGrid and LightIndices.
+    static constexpr int FIRST_UNIT = 1;
+
+    LightClusters();
+    LightClusters(LightClusters&& other) noexcept;
+    LightClusters& operator=(LightClusters&&) = delete;
+    ~LightClusters();
+
+    void build(const std::vector<PointLight>& lights, const LightFlicker& flicker, float tan_half_fov_x, float tan_half_fov_y);
+    // Does nothing while render_state isn't submitting, so headless runs don't send the buffers every frame.
+    void upload(const RenderState& render_state);
+    void bind(RenderState& render_state) const;
+
+    // xy: tangents of the half fovs, z: near edge of the first depth slice, w: depth slices per log unit.
+    glm::vec4 params() const { return cluster_params; }
+
+    int num_lights() const { return int(light_data.size() / 8); }
+    int num_indices() const { return int(indices.size()); }
+
+private:
+    static constexpr float NEAR = 0.5f;
+    static constexpr float FAR = 50.f;
+
+    int slice(float depth) const;
+
+    glm::vec4 cluster_params;
+    std::vector<float> light_data;
+    std::vector<GLuint> grid;
+    std::vector<GLuint> indices;
+
+    struct Range {
+        int x0, x1, y0, y1, z0, z1;
+    };
+    std::vector<Range> ranges;
+
+    GLuint buffers[3] = {};
+    GLuint textures[3] = {};
+};
+
+#endif //LD34_LIGHTING_HPP
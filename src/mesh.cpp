@@ -0,0 +1,386 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+MeshData load_obj_mesh(const std::string& fname) {
+    auto file = std::ifstream(fname);
+    if (!file) {
+        throw std::runtime_error("Failed to open mesh " + fname + "!");
+    }
+
+    std::vector<glm::vec3> obj_positions;
+    std::vector<glm::vec2> obj_texcoords;
+    std::vector<glm::vec3> obj_normals;
+
+    auto rv = MeshData();
+    std::map<std::array<float, 8>, std::uint32_t> welded;
+
+    // OBJ indices are 1-based, or relative to the end when negative.
+    auto resolve = [](int i, std::size_t size) {
+        return i < 0 ? int(size) + i : i - 1;
+    };
+
+    auto corner = [&](const std::string& token) {
+        int idx[3] = {0, 0, 0};
+        auto ss = std::istringstream(token);
+        for (int k=0; k<3; ++k) {
+            auto part = std::string();
+            if (!std::getline(ss, part, '/')) {
+                break;
+            }
+            if (!part.empty()) {
+                idx[k] = std::stoi(part);
+            }
+        }
+
+        auto key = std::array<float, 8>{};
+        auto p = obj_positions.at(resolve(idx[0], obj_positions.size()));
+        key[0] = p.x;
+        key[1] = p.y;
+        key[2] = p.z;
+        if (idx[1] != 0) {
+            auto t = obj_texcoords.at(resolve(idx[1], obj_texcoords.size()));
+            key[3] = t.x;
+            key[4] = t.y;
+        }
+        if (idx[2] != 0) {
+            auto n = obj_normals.at(resolve(idx[2], obj_normals.size()));
+            key[5] = n.x;
+            key[6] = n.y;
+            key[7] = n.z;
+        }
+
+        auto iter = welded.find(key);
+        if (iter != welded.end()) {
+            return iter->second;
+        }
+        auto v = std::uint32_t(rv.positions.size());
+        rv.positions.push_back({key[0], key[1], key[2]});
+        rv.texcoords.push_back({key[3], key[4]});
+        rv.normals.push_back({key[5], key[6], key[7]});
+        welded.emplace(key, v);
+        return v;
+    };
+
+    auto line = std::string();
+    while (std::getline(file, line)) {
+        auto ss = std::istringstream(line);
+        auto type = std::string();
+        ss >> type;
+        if (type == "v") {
+            auto p = glm::vec3();
+            ss >> p.x >> p.y >> p.z;
+            obj_positions.push_back(p);
+        } else if (type == "vt") {
+            auto t = glm::vec2();
+            ss >> t.x >> t.y;
+            // Same convention as sushi's loader: OBJ v runs bottom-up, our textures top-down.
+            t.y = 1.f - t.y;
+            obj_texcoords.push_back(t);
+        } else if (type == "vn") {
+            auto n = glm::vec3();
+            ss >> n.x >> n.y >> n.z;
+            obj_normals.push_back(n);
+        } else if (type == "f") {
+            auto corners = std::vector<std::uint32_t>();
+            auto token = std::string();
+            while (ss >> token) {
+                corners.push_back(corner(token));
+            }
+            for (std::size_t i=2; i<corners.size(); ++i) {
+                rv.indices.insert(end(rv.indices), {corners[0], corners[i-1], corners[i]});
+            }
+        }
+    }
+
+    return rv;
+}
+
+namespace {
+
+constexpr int FORSYTH_CACHE_SIZE = 32;
+
+float vertex_score(int cache_pos, int valence) {
+    if (valence == 0) {
+        return -1.f;
+    }
+    auto score = 0.f;
+    if (cache_pos >= 0) {
+        // The last triangle's vertices score the same, so there is no preference for order within it.
+        if (cache_pos < 3) {
+            score = 0.75f;
+        } else {
+            score = std::pow(1.f - float(cache_pos - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+    }
+    // Favor finishing off vertices with few triangles left.
+    return score + 2.f / std::sqrt(float(valence));
+}
+
+}
+
+void optimize_vertex_cache(MeshData& mesh) {
+    auto& indices = mesh.indices;
+    auto num_verts = int(mesh.positions.size());
+    auto num_tris = int(indices.size() / 3);
+
+    // Triangles not yet emitted that use each vertex, as the first `valence` entries of its range in `adjacent`.
+    std::vector<int> valence(num_verts, 0);
+    for (auto v : indices) {
+        ++valence[v];
+    }
+    std::vector<int> adjacent_start(num_verts + 1, 0);
+    for (int v=0; v<num_verts; ++v) {
+        adjacent_start[v+1] = adjacent_start[v] + valence[v];
+    }
+    std::vector<int> adjacent(indices.size());
+    {
+        auto fill = adjacent_start;
+        for (int t=0; t<num_tris; ++t) {
+            for (int k=0; k<3; ++k) {
+                adjacent[fill[indices[t*3+k]]++] = t;
+            }
+        }
+    }
+
+    std::vector<int> cache_pos(num_verts, -1);
+    std::vector<float> vscore(num_verts);
+    for (int v=0; v<num_verts; ++v) {
+        vscore[v] = vertex_score(-1, valence[v]);
+    }
+    std::vector<float> tscore(num_tris);
+    std::vector<bool> emitted(num_tris, false);
+    for (int t=0; t<num_tris; ++t) {
+        tscore[t] = vscore[indices[t*3]] + vscore[indices[t*3+1]] + vscore[indices[t*3+2]];
+    }
+
+    std::vector<int> cache;
+    std::vector<std::uint32_t> out;
+    out.reserve(indices.size());
+
+    auto best = -1;
+    for (int n=0; n<num_tris; ++n) {
+        if (best < 0) {
+            // Nothing in the cache has triangles left; start again from the best remaining triangle.
+            for (int t=0; t<num_tris; ++t) {
+                if (!emitted[t] && (best < 0 || tscore[t] > tscore[best])) {
+                    best = t;
+                }
+            }
+        }
+
+        emitted[best] = true;
+        for (int k=0; k<3; ++k) {
+            auto v = int(indices[best*3+k]);
+            out.push_back(std::uint32_t(v));
+
+            auto first = begin(adjacent) + adjacent_start[v];
+            auto last = first + valence[v];
+            std::iter_swap(std::find(first, last, best), last - 1);
+            --valence[v];
+
+            auto pos = std::find(begin(cache), end(cache), v);
+            if (pos != end(cache)) {
+                cache.erase(pos);
+            }
+            cache.insert(begin(cache), v);
+        }
+
+        // Vertices pushed out of the cache lose their cache bonus; their triangles are rescored below.
+        auto touched = cache;
+        while (int(cache.size()) > FORSYTH_CACHE_SIZE) {
+            cache_pos[cache.back()] = -1;
+            vscore[cache.back()] = vertex_score(-1, valence[cache.back()]);
+            cache.pop_back();
+        }
+        for (int i=0; i<int(cache.size()); ++i) {
+            cache_pos[cache[i]] = i;
+            vscore[cache[i]] = vertex_score(i, valence[cache[i]]);
+        }
+
+        best = -1;
+        for (auto v : touched) {
+            for (int a=adjacent_start[v]; a<adjacent_start[v]+valence[v]; ++a) {
+                auto t = adjacent[a];
+                tscore[t] = vscore[indices[t*3]] + vscore[indices[t*3+1]] + vscore[indices[t*3+2]];
+                if (best < 0 || tscore[t] > tscore[best]) {
+                    best = t;
+                }
+            }
+        }
+    }
+
+    indices = std::move(out);
+}
+
+void optimize_vertex_fetch(MeshData& mesh) {
+    std::vector<int> remap(mesh.positions.size(), -1);
+    auto next = 0;
+    for (auto& i : mesh.indices) {
+        if (remap[i] < 0) {
+            remap[i] = next++;
+        }
+        i = std::uint32_t(remap[i]);
+    }
+
+    auto rv = MeshData();
+    rv.positions.resize(next);
+    rv.texcoords.resize(next);
+    rv.normals.resize(next);
+    for (std::size_t v=0; v<remap.size(); ++v) {
+        if (remap[v] >= 0) {
+            rv.positions[remap[v]] = mesh.positions[v];
+            rv.texcoords[remap[v]] = mesh.texcoords[v];
+            rv.normals[remap[v]] = mesh.normals[v];
+        }
+    }
+    rv.indices = std::move(mesh.indices);
+    mesh = std::move(rv);
+}
+
+int simulate_vertex_cache(const std::vector<std::uint32_t>& indices, int cache_size) {
+    auto fifo = std::deque<std::uint32_t>();
+    auto misses = 0;
+    for (auto i : indices) {
+        if (std::find(begin(fifo), end(fifo), i) == end(fifo)) {
+            ++misses;
+            fifo.push_back(i);
+            if (int(fifo.size()) > cache_size) {
+                fifo.pop_front();
+            }
+        }
+    }
+    return misses;
+}
+
+IndexedMesh::IndexedMesh(const MeshData& data) {
+    vertex_count = int(data.positions.size());
+    index_count = int(data.indices.size());
+
+    auto vertices = std::vector<float>();
+    vertices.reserve(vertex_count * 8);
+    for (int v=0; v<vertex_count; ++v) {
+        auto& p = data.positions[v];
+        auto& t = data.texcoords[v];
+        auto& n = data.normals[v];
+        vertices.insert(end(vertices), {p.x, p.y, p.z, t.x, t.y, n.x, n.y, n.z});
+    }
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(2, buffers);
+    glBindVertexArray(vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<const void*>(0));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<const void*>(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), reinterpret_cast<const void*>(5 * sizeof(float)));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+    if (vertex_count <= 0x10000) {
+        auto small = std::vector<std::uint16_t>(begin(data.indices), end(data.indices));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, small.size() * sizeof(std::uint16_t), small.data(), GL_STATIC_DRAW);
+        index_type = GL_UNSIGNED_SHORT;
+    } else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indices.size() * sizeof(std::uint32_t), data.indices.data(), GL_STATIC_DRAW);
+        index_type = GL_UNSIGNED_INT;
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+IndexedMesh::IndexedMesh(IndexedMesh&& other) noexcept :
+    vao(std::exchange(other.vao, 0)),
+    vertex_count(other.vertex_count),
+    index_count(other.index_count),
+    index_type(other.index_type) {
+    buffers[0] = std::exchange(other.buffers[0], 0);
+    buffers[1] = std::exchange(other.buffers[1], 0);
+}
+
+IndexedMesh& IndexedMesh::operator=(IndexedMesh&& other) noexcept {
+    std::swap(vao, other.vao);
+    std::swap(buffers[0], other.buffers[0]);
+    std::swap(buffers[1], other.buffers[1]);
+    vertex_count = other.vertex_count;
+    index_count = other.index_count;
+    index_type = other.index_type;
+    return *this;
+}
+
+IndexedMesh::~IndexedMesh() {
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(2, buffers);
+}
+
+void IndexedMesh::draw() const {
+    glBindVertexArray(vao);
+    glDrawElements(GL_TRIANGLES, index_count, index_type, nullptr);
+}
+
+IndexedMesh load_optimized_mesh(const std::string& fname) {
+    // Cache size for the estimates; conservative for desktop GPUs and for llvmpipe.
+    constexpr int CACHE_SIZE = 16;
+
+    auto data = load_obj_mesh(fname);
+    auto num_tris = int(data.indices.size() / 3);
+    auto welded = simulate_vertex_cache(data.indices, CACHE_SIZE);
+    optimize_vertex_cache(data);
+    optimize_vertex_fetch(data);
+    auto optimized = simulate_vertex_cache(data.indices, CACHE_SIZE);
+
+    // sushi meshes are unindexed, so every corner used to be shaded.
+    std::clog << "Mesh " << fname << ": " << num_tris << " triangles, "
+              << num_tris * 3 << " -> " << data.positions.size() << " vertices, "
+              << (data.positions.size() <= 0x10000 ? 16 : 32) << "-bit indices, "
+              << "VS invocations per draw " << num_tris * 3 << " -> " << optimized
+              << " (welded only " << welded << ", FIFO" << CACHE_SIZE << ")" << std::endl;
+
+    return IndexedMesh(data);
+}
+
+#ifndef GL_VERTEX_SHADER_INVOCATIONS_ARB
+#define GL_VERTEX_SHADER_INVOCATIONS_ARB 0x82F0
+#endif
+
+long long measure_vertex_invocations(const std::function<void()>& draw) {
+    static const bool supported = []{
+        GLint num_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+        for (GLint i=0; i<num_extensions; ++i) {
+            auto name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (name && std::strcmp(name, "GL_ARB_pipeline_statistics_query") == 0) {
+                return true;
+            }
+        }
+        return false;
+    }();
+
+    if (!supported) {
+        return -1;
+    }
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, query);
+    draw();
+    glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+    GLuint64 result = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result);
+    glDeleteQueries(1, &query);
+    return (long long)result;
+}
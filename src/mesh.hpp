@@ -0,0 +1,59 @@
+#ifndef LD34_MESH_HPP
+#define LD34_MESH_HPP
+
+#include <sushi/sushi.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Welded, indexed triangle list as it comes out of the OBJ loader and the optimization passes.
+struct MeshData {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texcoords;
+    std::vector<glm::vec3> normals;
+    std::vector<std::uint32_t> indices;
+};
+
+// Reads an OBJ file and welds corners with identical position, texcoord and normal into shared vertices.
+MeshData load_obj_mesh(const std::string& fname);
+
+// Reorders triangles for the post-transform vertex cache (Forsyth, "Linear-Speed Vertex Cache Optimisation").
+void optimize_vertex_cache(MeshData& mesh);
+
+// Renumbers vertices in order of first use so that vertex fetch walks memory forwards.
+void optimize_vertex_fetch(MeshData& mesh);
+
+// Vertex shader invocations a FIFO post-transform cache of the given size would need for one draw.
+int simulate_vertex_cache(const std::vector<std::uint32_t>& indices, int cache_size);
+
+// GPU side of an optimized mesh; indices are 16-bit whenever the vertex count allows.
+class IndexedMesh {
+public:
+    explicit IndexedMesh(const MeshData& data);
+    IndexedMesh(IndexedMesh&& other) noexcept;
+    IndexedMesh& operator=(IndexedMesh&& other) noexcept;
+    ~IndexedMesh();
+
+    void draw() const;
+
+    int num_vertices() const { return vertex_count; }
+    int num_indices() const { return index_count; }
+
+private:
+    GLuint vao = 0;
+    GLuint buffers[2] = {};
+    int vertex_count = 0;
+    int index_count = 0;
+    GLenum index_type = GL_UNSIGNED_SHORT;
+};
+
+// Load, weld and optimize an OBJ, logging vertex shader invocations per draw before and after.
+IndexedMesh load_optimized_mesh(const std::string& fname);
+
+// Vertex shader invocations the driver reports for whatever `draw` submits,
+// or -1 when ARB_pipeline_statistics_query is not available.
+long long measure_vertex_invocations(const std::function<void()>& draw);
+
+#endif //LD34_MESH_HPP
@@ -0,0 +1,90 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+constexpr int Histogram::SUB_BUCKETS;
+constexpr int Histogram::NUM_BUCKETS;
+
+int Histogram::bucket_of(std::uint64_t value) {
+    if (value < 2 * SUB_BUCKETS) {
+        return int(value);
+    }
+    // Keep the top five bits: the leading one picks the power of two, the other four the linear bucket.
+    auto msb = 63 - __builtin_clzll(value);
+    auto shift = msb - 4;
+    return shift * SUB_BUCKETS + int(value >> shift);
+}
+
+std::uint64_t Histogram::bucket_value(int bucket) {
+    if (bucket < 2 * SUB_BUCKETS) {
+        return std::uint64_t(bucket);
+    }
+    auto shift = bucket / SUB_BUCKETS - 1;
+    return std::uint64_t(bucket - shift * SUB_BUCKETS) << shift;
+}
+
+void Histogram::record(std::uint64_t value) {
+    ++buckets[bucket_of(value)];
+    ++total;
+    sum += value;
+    lo = std::min(lo, value);
+    hi = std::max(hi, value);
+}
+
+std::uint64_t Histogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    auto rank = std::uint64_t(p / 100.0 * (total - 1)) + 1;
+    auto seen = std::uint64_t(0);
+    for (int i=0; i<NUM_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(std::max(bucket_value(i), lo), hi);
+        }
+    }
+    return hi;
+}
+
+Json::Value MetricsRegistry::to_json() const {
+    auto root = Json::Value(Json::objectValue);
+
+    auto& cs = root["counters"] = Json::Value(Json::objectValue);
+    for (auto& c : counters) {
+        cs[c.first] = Json::Int64(c.second.value());
+    }
+
+    auto& gs = root["gauges"] = Json::Value(Json::objectValue);
+    for (auto& g : gauges) {
+        gs[g.first] = g.second.value();
+    }
+
+    auto& hs = root["histograms"] = Json::Value(Json::objectValue);
+    for (auto& h : histograms) {
+        auto& out = hs[h.first];
+        out["count"] = Json::UInt64(h.second.count());
+        out["min"] = Json::UInt64(h.second.min());
+        out["max"] = Json::UInt64(h.second.max());
+        out["mean"] = h.second.mean();
+        out["p50"] = Json::UInt64(h.second.percentile(50));
+        out["p90"] = Json::UInt64(h.second.percentile(90));
+        out["p99"] = Json::UInt64(h.second.percentile(99));
+        out["p999"] = Json::UInt64(h.second.percentile(99.9));
+    }
+
+    return root;
+}
+
+void MetricsRegistry::write_json(const std::string& fname) const {
+    auto file = std::ofstream(fname);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + fname + " for writing!");
+    }
+    auto builder = Json::StreamWriterBuilder();
+    auto writer = std::unique_ptr<Json::StreamWriter>(builder.newStreamWriter());
+    writer->write(to_json(), &file);
+    file << std::endl;
+}
@@ -0,0 +1,85 @@
+#ifndef LD34_METRICS_HPP
+#define LD34_METRICS_HPP
+
+#include <json/json.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+class Counter {
+public:
+    void add(std::int64_t n = 1) { count += n; }
+    std::int64_t value() const { return count; }
+
+private:
+    std::int64_t count = 0;
+};
+
+class Gauge {
+public:
+    void set(double v) { val = v; }
+    double value() const { return val; }
+
+private:
+    double val = 0.0;
+};
+
+// HDR-style histogram of non-negative integers: exact below 32, then 16 linear buckets per power of two,
+// so any recorded value is reported within about 6% no matter its magnitude, in fixed memory.
+class Histogram {
+public:
+    void record(std::uint64_t value);
+
+    std::uint64_t count() const { return total; }
+    std::uint64_t min() const { return total ? lo : 0; }
+    std::uint64_t max() const { return hi; }
+    double mean() const { return total ? double(sum) / total : 0.0; }
+    std::uint64_t percentile(double p) const;
+
+private:
+    static constexpr int SUB_BUCKETS = 16;
+    static constexpr int NUM_BUCKETS = 64 * SUB_BUCKETS;
+
+    static int bucket_of(std::uint64_t value);
+    static std::uint64_t bucket_value(int bucket);
+
+    std::array<std::uint64_t, NUM_BUCKETS> buckets = {};
+    std::uint64_t total = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t lo = ~std::uint64_t(0);
+    std::uint64_t hi = 0;
+};
+
+// Named metrics live for the whole run; references handed out stay valid, so hot paths can keep them.
+class MetricsRegistry {
+public:
+    Counter& counter(const std::string& name) { return counters[name]; }
+    Gauge& gauge(const std::string& name) { return gauges[name]; }
+    Histogram& histogram(const std::string& name) { return histograms[name]; }
+
+    Json::Value to_json() const;
+    void write_json(const std::string& fname) const;
+
+private:
+    std::map<std::string, Counter> counters;
+    std::map<std::string, Gauge> gauges;
+    std::map<std::string, Histogram> histograms;
+};
+
+// Counts live instances of the type that holds it as a member.
+template <typename T>
+struct InstanceCount {
+    static int live;
+
+    InstanceCount() { ++live; }
+    InstanceCount(const InstanceCount&) { ++live; }
+    InstanceCount& operator=(const InstanceCount&) = default;
+    ~InstanceCount() { --live; }
+};
+
+template <typename T>
+int InstanceCount<T>::live = 0;
+
+#endif //LD34_METRICS_HPP
@@ -0,0 +1,157 @@
+#include "music_stream.hpp"
+
+#include <windows.h>
+#include <intrin.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+constexpr unsigned BufferedStream::DECODE_FRAMES;
+
+SampleRing::SampleRing(std::size_t min_frames, unsigned channels) : channels(channels), head(0), tail(0) {
+    auto frames = std::size_t(1);
+    while (frames < min_frames) {
+        frames *= 2;
+    }
+    mask = frames - 1;
+    data.resize(frames * channels);
+}
+
+std::size_t SampleRing::available() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+std::size_t SampleRing::space() const {
+    return capacity() - available();
+}
+
+std::size_t SampleRing::write(const float* frames, std::size_t count) {
+    auto h = head.load(std::memory_order_relaxed);
+    count = std::min(count, capacity() - (h - tail.load(std::memory_order_acquire)));
+    for (std::size_t i=0; i<count; ++i) {
+        std::memcpy(&data[((h + i) & mask) * channels], frames + i * channels, channels * sizeof(float));
+    }
+    head.store(h + count, std::memory_order_release);
+    return count;
+}
+
+std::size_t SampleRing::read(float* frames, std::size_t count) {
+    auto t = tail.load(std::memory_order_relaxed);
+    count = std::min(count, head.load(std::memory_order_acquire) - t);
+    for (std::size_t i=0; i<count; ++i) {
+        std::memcpy(frames + i * channels, &data[((t + i) & mask) * channels], channels * sizeof(float));
+    }
+    tail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+BufferedStream::BufferedStream(SoLoud::AudioSource& source, float buffer_seconds) :
+    source(source),
+    ring(std::size_t(std::max(buffer_seconds * source.mBaseSamplerate, 2.f * DECODE_FRAMES)), source.mChannels),
+    running(true),
+    finished(false),
+    num_underruns(0),
+    decode_cycles(0),
+    max_decode_cycles(0),
+    start_cycles(__rdtsc()),
+    start_time(std::chrono::steady_clock::now()) {
+    mChannels = source.mChannels;
+    mBaseSamplerate = source.mBaseSamplerate;
+    thread = std::thread([this]{ decode(); });
+}
+
+BufferedStream::~BufferedStream() {
+    running = false;
+    thread.join();
+}
+
+SoLoud::AudioSourceInstance* BufferedStream::createInstance() {
+    return new BufferedStreamInstance(*this);
+}
+
+// QueryThreadCycleTime counts at the rate of the processor's time stamp counter.
+double BufferedStream::cycles_per_second() const {
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    if (seconds <= 0.0) {
+        return 1.0;
+    }
+    return (__rdtsc() - start_cycles) / seconds;
+}
+
+double BufferedStream::decode_seconds() const {
+    return decode_cycles / cycles_per_second();
+}
+
+double BufferedStream::max_decode_seconds() const {
+    return max_decode_cycles / cycles_per_second();
+}
+
+static std::uint64_t thread_cycles() {
+    ULONG64 cycles = 0;
+    QueryThreadCycleTime(GetCurrentThread(), &cycles);
+    return cycles;
+}
+
+void BufferedStream::decode() {
+    // Below the game and the mixer; the ring covers for it being late.
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+    auto instance = std::unique_ptr<SoLoud::AudioSourceInstance>(source.createInstance());
+    instance->init(source, 0);
+
+    auto channels = mChannels;
+    auto planar = std::vector<float>(DECODE_FRAMES * channels);
+    auto interleaved = std::vector<float>(DECODE_FRAMES * channels);
+
+    while (running) {
+        if (instance->hasEnded()) {
+            finished = true;
+            break;
+        }
+        if (ring.space() < DECODE_FRAMES) {
+            // An eighth of the ring's length; it gets topped up long before it could run dry.
+            auto drain_ms = int(1000.f * ring.capacity() / mBaseSamplerate / 8.f);
+            Sleep(std::max(drain_ms, 1));
+            continue;
+        }
+
+        auto decode_start = thread_cycles();
+        instance->getAudio(planar.data(), DECODE_FRAMES);
+        auto decode_time = thread_cycles() - decode_start;
+        decode_cycles += decode_time;
+        if (decode_time > max_decode_cycles) {
+            max_decode_cycles = decode_time;
+        }
+
+        // SoLoud hands out one channel after another; the ring keeps whole frames together.
+        for (unsigned i=0; i<DECODE_FRAMES; ++i) {
+            for (unsigned c=0; c<channels; ++c) {
+                interleaved[i * channels + c] = planar[c * DECODE_FRAMES + i];
+            }
+        }
+        ring.write(interleaved.data(), DECODE_FRAMES);
+    }
+}
+
+BufferedStreamInstance::BufferedStreamInstance(BufferedStream& parent) : parent(parent) {}
+
+void BufferedStreamInstance::getAudio(float* buffer, unsigned int samples) {
+    frames.resize(samples * mChannels);
+    auto got = parent.ring.read(frames.data(), samples);
+    if (got < samples && !parent.finished) {
+        ++parent.num_underruns;
+    }
+    for (unsigned c=0; c<mChannels; ++c) {
+        auto out = buffer + c * samples;
+        for (unsigned i=0; i<got; ++i) {
+            out[i] = frames[i * mChannels + c];
+        }
+        std::fill(out + got, out + samples, 0.f);
+    }
+}
+
+bool BufferedStreamInstance::hasEnded() {
+    return parent.finished && parent.ring.available() == 0;
+}
@@ -0,0 +1,84 @@
+#ifndef LD34_MUSIC_STREAM_HPP
+#define LD34_MUSIC_STREAM_HPP
+
+#include <soloud.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Single producer, single consumer ring of interleaved sample frames. Neither side ever blocks.
+class SampleRing {
+public:
+    SampleRing(std::size_t min_frames, unsigned channels);
+
+    std::size_t capacity() const { return mask + 1; }
+    std::size_t available() const;
+    std::size_t space() const;
+
+    // Both return the number of frames actually moved.
+    std::size_t write(const float* frames, std::size_t count);
+    std::size_t read(float* frames, std::size_t count);
+
+private:
+    unsigned channels;
+    std::size_t mask;
+    std::vector<float> data;
+    std::atomic<std::size_t> head; // Frames written, only advanced by the producer
+    std::atomic<std::size_t> tail; // Frames read, only advanced by the consumer
+};
+
+// Plays another source, typically a WavStream, through a ring that a low priority thread keeps topped up,
+// so decoding never happens on the mixer thread. Only one instance may play at a time.
+class BufferedStream : public SoLoud::AudioSource {
+public:
+    static constexpr unsigned DECODE_FRAMES = 1024;
+
+    // The ring holds at least two decodes' worth, however short buffer_seconds is.
+    BufferedStream(SoLoud::AudioSource& source, float buffer_seconds);
+    ~BufferedStream();
+
+    SoLoud::AudioSourceInstance* createInstance() override;
+
+    // Mixer callbacks that found the ring short, since the start.
+    int underruns() const { return num_underruns; }
+    // CPU time the decoder thread spent in decode calls, and the longest single one. Time it spent preempted
+    // doesn't count. Both are measured in thread cycles and converted at the rate the cycle counter has run since the start.
+    double decode_seconds() const;
+    double max_decode_seconds() const;
+    // How full the ring is, 0 to 1.
+    float fill() const { return float(ring.available()) / ring.capacity(); }
+
+private:
+    friend class BufferedStreamInstance;
+
+    void decode();
+    double cycles_per_second() const;
+
+    SoLoud::AudioSource& source;
+    SampleRing ring;
+    std::atomic<bool> running;
+    std::atomic<bool> finished;
+    std::atomic<int> num_underruns;
+    std::atomic<std::uint64_t> decode_cycles;     // As QueryThreadCycleTime counts them
+    std::atomic<std::uint64_t> max_decode_cycles;
+    std::uint64_t start_cycles;
+    std::chrono::steady_clock::time_point start_time;
+    std::thread thread;
+};
+
+class BufferedStreamInstance : public SoLoud::AudioSourceInstance {
+public:
+    explicit BufferedStreamInstance(BufferedStream& parent);
+
+    void getAudio(float* buffer, unsigned int samples) override;
+    bool hasEnded() override;
+
+private:
+    BufferedStream& parent;
+    std::vector<float> frames;
+};
+
+#endif //LD34_MUSIC_STREAM_HPP
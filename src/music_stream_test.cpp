@@ -0,0 +1,121 @@
+#include "music_stream.hpp"
+
+#include <soloud.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Plays a BufferedStream through SoLoud's null driver, mixing at the pace a real device would, and checks that
+// the mixer gets the source's samples with no underruns. Then does the same with a ring far shorter than a decode.
+
+namespace {
+
+constexpr unsigned RATE = 44100;
+constexpr unsigned MIX_FRAMES = 512;
+
+// A stereo sine of a fixed length, standing in for the ambiance WavStream.
+class SineSource : public SoLoud::AudioSource {
+public:
+    explicit SineSource(float seconds) : length(unsigned(seconds * RATE)) {
+        mChannels = 2;
+        mBaseSamplerate = float(RATE);
+    }
+
+    SoLoud::AudioSourceInstance* createInstance() override;
+
+    unsigned length;
+};
+
+class SineInstance : public SoLoud::AudioSourceInstance {
+public:
+    explicit SineInstance(const SineSource& parent) : parent(parent) {}
+
+    void getAudio(float* buffer, unsigned int samples) override {
+        for (unsigned i=0; i<samples; ++i) {
+            auto value = pos + i < parent.length ? 0.5f * std::sin((pos + i) * 440.f * 6.2831853f / RATE) : 0.f;
+            buffer[i] = value;
+            buffer[samples + i] = value;
+        }
+        pos += samples;
+    }
+
+    bool hasEnded() override {
+        return pos >= parent.length;
+    }
+
+private:
+    const SineSource& parent;
+    unsigned pos = 0;
+};
+
+SoLoud::AudioSourceInstance* SineSource::createInstance() {
+    return new SineInstance(*this);
+}
+
+struct Result {
+    int underruns;
+    float peak;
+};
+
+// Mixes `seconds` of audio in real time, once the decoder has had the chance to fill the ring.
+Result play(SoLoud::Soloud& soloud, float buffer_seconds, float seconds) {
+    auto sine = SineSource(seconds + 0.5f);
+    BufferedStream music (sine, buffer_seconds);
+
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + std::chrono::milliseconds(200);
+    while (music.fill() < 0.5f && clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    soloud.play(music);
+    auto mixed = std::vector<float>(MIX_FRAMES * 2);
+    auto peak = 0.f;
+    auto start = clock::now();
+    auto chunk = std::chrono::duration<double>(double(MIX_FRAMES) / RATE);
+    auto num_chunks = int(seconds * RATE / MIX_FRAMES);
+    for (int i=0; i<num_chunks; ++i) {
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(chunk * i));
+        soloud.mix(mixed.data(), MIX_FRAMES);
+        for (auto sample : mixed) {
+            peak = std::max(peak, std::abs(sample));
+        }
+    }
+    soloud.stopAudioSource(music);
+    return {music.underruns(), peak};
+}
+
+}
+
+int main() {
+    SoLoud::Soloud soloud;
+    soloud.init(SoLoud::Soloud::CLIP_ROUNDOFF, SoLoud::Soloud::NULLDRIVER, RATE, MIX_FRAMES);
+
+    auto failures = 0;
+    auto check = [&](const char* name, float buffer_seconds) {
+        // Long enough for the tiny ring to wrap several times, short enough not to slow ctest down.
+        auto result = play(soloud, buffer_seconds, 0.25f);
+        std::cout << name << ": " << result.underruns << " underruns, peak " << result.peak << std::endl;
+        if (result.underruns != 0) {
+            std::cerr << name << ": expected no underruns" << std::endl;
+            ++failures;
+        }
+        if (result.peak < 0.1f) {
+            std::cerr << name << ": expected the sine to reach the mixer" << std::endl;
+            ++failures;
+        }
+    };
+
+    check("default buffer", 2.f);
+    // Shorter than one decode; the ring is made big enough that the decoder still runs.
+    check("tiny buffer", 0.001f);
+
+    soloud.deinit();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,195 @@
+#include "post_process.hpp"
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+constexpr int FisheyeResolve::TILE_WIDTH;
+constexpr int FisheyeResolve::TILE_HEIGHT;
+
+void Image::resize(int w, int h) {
+    if (w == width && h == height) {
+        return;
+    }
+    width = w;
+    height = h;
+    pixels.resize(std::size_t(w) * h);
+}
+
+ThreadPool::ThreadPool(int num_threads) : remaining(0) {
+    num_threads = std::max(num_threads, 1);
+    for (int i=0; i<num_threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (int i=1; i<num_threads; ++i) {
+        threads.emplace_back([this, i]{ worker(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) {
+        return;
+    }
+
+    // Contiguous runs per worker, so that neighbouring tiles stay on one thread unless it falls behind.
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        task = &fn;
+        remaining = count;
+        auto n = size();
+        for (int k=0; k<n; ++k) {
+            std::lock_guard<std::mutex> queue_lock (queues[k]->mutex);
+            for (int i=count*k/n; i<count*(k+1)/n; ++i) {
+                queues[k]->items.push_back(i);
+            }
+        }
+        ++generation;
+    }
+    wake.notify_all();
+
+    while (run_one(0)) {}
+
+    std::unique_lock<std::mutex> lock (mutex);
+    done.wait(lock, [&]{ return remaining == 0; });
+    task = nullptr;
+}
+
+bool ThreadPool::run_one(int self) {
+    auto n = size();
+    auto item = -1;
+    {
+        auto& own = *queues[self];
+        std::lock_guard<std::mutex> lock (own.mutex);
+        if (!own.items.empty()) {
+            item = own.items.front();
+            own.items.pop_front();
+        }
+    }
+    for (int k=1; k<n && item < 0; ++k) {
+        auto& victim = *queues[(self + k) % n];
+        std::lock_guard<std::mutex> lock (victim.mutex);
+        if (!victim.items.empty()) {
+            item = victim.items.back();
+            victim.items.pop_back();
+        }
+    }
+    if (item < 0) {
+        return false;
+    }
+
+    (*task)(item);
+    if (--remaining == 0) {
+        std::lock_guard<std::mutex> lock (mutex);
+        done.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::worker(int self) {
+    auto seen = std::uint64_t(0);
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock (mutex);
+            wake.wait(lock, [&]{ return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        while (run_one(self)) {}
+    }
+}
+
+namespace {
+
+// Bilinear sample at (x, y) in texel space, texel centers on the integers, clamped to the edges. Returns RGBA.
+inline __m128 sample_bilinear(const Image& src, float x, float y) {
+    x = std::min(std::max(x, 0.f), float(src.width - 1));
+    y = std::min(std::max(y, 0.f), float(src.height - 1));
+    auto x0 = std::min(int(x), src.width - 2);
+    auto y0 = std::min(int(y), src.height - 2);
+    auto fx = _mm_set1_ps(x - x0);
+    auto fy = _mm_set1_ps(y - y0);
+
+    // Two neighbouring texels per row in one 8 byte load, widened to a float per channel.
+    auto row0 = &src.pixels[std::size_t(y0) * src.width + x0];
+    auto row1 = row0 + src.width;
+    auto zero = _mm_setzero_si128();
+    auto p0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row0)), zero);
+    auto p1 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row1)), zero);
+    auto t00 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p0, zero));
+    auto t01 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p0, zero));
+    auto t10 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p1, zero));
+    auto t11 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p1, zero));
+
+    auto top = _mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(t01, t00), fx));
+    auto bottom = _mm_add_ps(t10, _mm_mul_ps(_mm_sub_ps(t11, t10), fx));
+    return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy));
+}
+
+inline std::uint32_t pack_rgba(__m128 color) {
+    auto i = _mm_cvtps_epi32(color);
+    i = _mm_packs_epi32(i, i);
+    i = _mm_packus_epi16(i, i);
+    return std::uint32_t(_mm_cvtsi128_si32(i));
+}
+
+void resolve_tile(const Image& src, Image& dst, int x0, int y0, int x1, int y1, int aa, bool fisheye) {
+    auto weight = _mm_set1_ps(1.f / (aa * aa));
+    auto first_tap = -(aa - 1) / 2.f;
+    for (int y=y0; y<y1; ++y) {
+        auto out = &dst.pixels[std::size_t(y) * dst.width];
+        for (int x=x0; x<x1; ++x) {
+            auto u = (x + 0.5f) / dst.width - 0.5f;
+            auto v = (y + 0.5f) / dst.height - 0.5f;
+            if (fisheye) {
+                // fisheye() with tan(FisheyeTheta) cancelled out of a / c.
+                auto z = std::sqrt(std::max(1.f - u * u - v * v, 0.f));
+                auto k = std::sqrt(0.5f) / z;
+                u *= k;
+                v *= k;
+            }
+            auto sx = (u + 0.5f) * src.width - 0.5f + first_tap;
+            auto sy = (v + 0.5f) * src.height - 0.5f + first_tap;
+
+            auto sum = _mm_setzero_ps();
+            for (int j=0; j<aa; ++j) {
+                for (int i=0; i<aa; ++i) {
+                    sum = _mm_add_ps(sum, sample_bilinear(src, sx + i, sy + j));
+                }
+            }
+            out[x] = pack_rgba(_mm_mul_ps(sum, weight));
+        }
+    }
+}
+
+}
+
+FisheyeResolve::FisheyeResolve(int num_threads) : pool(num_threads) {}
+
+void FisheyeResolve::run(const Image& src, Image& dst, int aa, bool fisheye) {
+    if (src.width < 2 || src.height < 2 || dst.width * aa != src.width || dst.height * aa != src.height) {
+        throw std::runtime_error("Fisheye resolve image sizes don't match!");
+    }
+
+    auto tiles_x = (dst.width + TILE_WIDTH - 1) / TILE_WIDTH;
+    auto tiles_y = (dst.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    pool.parallel_for(tiles_x * tiles_y, [&](int tile) {
+        auto x0 = (tile % tiles_x) * TILE_WIDTH;
+        auto y0 = (tile / tiles_x) * TILE_HEIGHT;
+        resolve_tile(src, dst, x0, y0, std::min(x0 + TILE_WIDTH, dst.width), std::min(y0 + TILE_HEIGHT, dst.height), aa, fisheye);
+    });
+}
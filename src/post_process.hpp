@@ -0,0 +1,79 @@
+#ifndef LD34_POST_PROCESS_HPP
+#define LD34_POST_PROCESS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// RGBA8 pixels, rows bottom to top, the way glReadPixels and glTexImage2D lay them out.
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<std::uint32_t> pixels;
+
+    void resize(int w, int h);
+};
+
+// Fixed set of workers, each with its own queue of items. A worker takes from the front of its own queue
+// and, once that is empty, steals from the back of the others', so uneven items still finish together.
+class ThreadPool {
+public:
+    // The calling thread is one of the workers, so this starts num_threads-1 threads.
+    explicit ThreadPool(int num_threads);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    int size() const { return int(queues.size()); }
+
+    // Runs fn(i) for every i in [0,count) and returns once they have all finished.
+    void parallel_for(int count, const std::function<void(int)>& fn);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> items;
+    };
+
+    bool run_one(int self);
+    void worker(int self);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)>* task = nullptr;
+    std::atomic<int> remaining;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+};
+
+// The final blit on the CPU: fisheye() from fragment.glsl and the config.AA box downsample in one pass
+// over the output, in tiles spread across a ThreadPool. Each output pixel averages AA x AA bilinear samples,
+// one source texel apart, around the point fisheye() maps it to; with an AA of 1 that is exactly what the
+// GPU blit does. Samples are filtered four channels at a time with SSE2.
+class FisheyeResolve {
+public:
+    static constexpr int TILE_WIDTH = 64;
+    static constexpr int TILE_HEIGHT = 16;
+
+    explicit FisheyeResolve(int num_threads);
+
+    int num_threads() const { return pool.size(); }
+
+    // dst must already be sized to src divided by aa, and src must be at least 2x2.
+    void run(const Image& src, Image& dst, int aa, bool fisheye);
+
+private:
+    ThreadPool pool;
+};
+
+#endif //LD34_POST_PROCESS_HPP
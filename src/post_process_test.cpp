@@ -0,0 +1,110 @@
+#include "post_process.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+// Checks FisheyeResolve against a plain scalar version of the blit, written straight from fragment.glsl:
+// every output pixel of every channel must be within 1 of it. Sizes are odd so that tiles come out ragged
+// on both axes, and the thread counts are more than there are tiles for the smallest image.
+
+namespace {
+
+float texel(const Image& src, int x, int y, int channel) {
+    x = std::min(std::max(x, 0), src.width - 1);
+    y = std::min(std::max(y, 0), src.height - 1);
+    return float((src.pixels[std::size_t(y) * src.width + x] >> (8 * channel)) & 0xFF);
+}
+
+float bilinear(const Image& src, float x, float y, int channel) {
+    x = std::min(std::max(x, 0.f), float(src.width - 1));
+    y = std::min(std::max(y, 0.f), float(src.height - 1));
+    auto x0 = std::min(int(x), src.width - 2);
+    auto y0 = std::min(int(y), src.height - 2);
+    auto fx = x - x0;
+    auto fy = y - y0;
+    auto top = texel(src, x0, y0, channel) * (1.f - fx) + texel(src, x0 + 1, y0, channel) * fx;
+    auto bottom = texel(src, x0, y0 + 1, channel) * (1.f - fx) + texel(src, x0 + 1, y0 + 1, channel) * fx;
+    return top * (1.f - fy) + bottom * fy;
+}
+
+// fisheye() as the shader has it, tan(FisheyeTheta) and all.
+void fisheye(float& u, float& v) {
+    auto theta = 2.0943951f;
+    auto z = std::sqrt(std::max(1.f - u * u - v * v, 0.f));
+    auto a = 1.f / (z * std::tan(theta));
+    auto c = 2.f * 0.5f / (std::sqrt(0.5f) * std::tan(theta));
+    u = u * a / c;
+    v = v * a / c;
+}
+
+int max_error(const Image& src, const Image& dst, int aa, bool use_fisheye) {
+    auto rv = 0;
+    for (int y=0; y<dst.height; ++y) {
+        for (int x=0; x<dst.width; ++x) {
+            auto u = (x + 0.5f) / dst.width - 0.5f;
+            auto v = (y + 0.5f) / dst.height - 0.5f;
+            if (use_fisheye) {
+                fisheye(u, v);
+            }
+            auto sx = (u + 0.5f) * src.width - 0.5f - (aa - 1) / 2.f;
+            auto sy = (v + 0.5f) * src.height - 0.5f - (aa - 1) / 2.f;
+            for (int c=0; c<4; ++c) {
+                auto sum = 0.f;
+                for (int j=0; j<aa; ++j) {
+                    for (int i=0; i<aa; ++i) {
+                        sum += bilinear(src, sx + i, sy + j, c);
+                    }
+                }
+                auto expected = int(std::lround(sum / (aa * aa)));
+                auto got = int((dst.pixels[std::size_t(y) * dst.width + x] >> (8 * c)) & 0xFF);
+                rv = std::max(rv, std::abs(got - expected));
+            }
+        }
+    }
+    return rv;
+}
+
+}
+
+int main() {
+    struct Size {
+        int width;
+        int height;
+    };
+
+    auto rng = std::mt19937(1);
+    auto failures = 0;
+    for (auto size : {Size{3, 5}, Size{67, 17}, Size{161, 99}}) {
+        for (auto aa : {1, 2}) {
+            auto src = Image();
+            src.resize(size.width * aa, size.height * aa);
+            for (auto& p : src.pixels) {
+                p = rng();
+            }
+            for (auto use_fisheye : {false, true}) {
+                for (auto threads : {1, 4}) {
+                    auto dst = Image();
+                    dst.resize(size.width, size.height);
+                    FisheyeResolve(threads).run(src, dst, aa, use_fisheye);
+                    auto error = max_error(src, dst, aa, use_fisheye);
+                    if (error > 1) {
+                        std::cerr << size.width << "x" << size.height << " aa " << aa << " fisheye " << use_fisheye
+                                  << " threads " << threads << ": off by " << error << std::endl;
+                        ++failures;
+                    }
+                }
+            }
+        }
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " failures" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "FisheyeResolve matches the scalar blit to within 1" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+#ifndef LD34_RANDOM_HPP
+#define LD34_RANDOM_HPP
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Finalizer from SplitMix64. Good enough to turn structured ids (hall paths, stream tags) into keys.
+inline std::uint64_t mix64(std::uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+// The output is a pure function of (key, counter), so every key is an independent stream,
+// constructing one costs nothing, and discard() is O(1).
+// Satisfies UniformRandomBitGenerator, so the std distributions work with it.
+class Philox {
+public:
+    using result_type = std::uint32_t;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    Philox() : Philox(0, 0) {}
+    Philox(std::uint64_t seed, std::uint64_t stream) : key(mix64(seed) ^ mix64(~stream)) {}
+
+    // Independent child stream; the parent's position does not matter.
+    Philox split(std::uint64_t stream) const {
+        auto rv = Philox();
+        rv.key = mix64(key ^ mix64(stream));
+        return rv;
+    }
+
+    result_type operator()() {
+        if (index == 4) {
+            refill();
+        }
+        return block[index++];
+    }
+
+    void discard(unsigned long long n) {
+        auto left = 4ull - index;
+        if (n < left) {
+            index += int(n);
+            return;
+        }
+        n -= left;
+        advance(n / 4);
+        index = 4;
+        if (n % 4 != 0) {
+            refill();
+            index = int(n % 4);
+        }
+    }
+
+private:
+    std::uint64_t key;
+    std::uint64_t counter_lo = 0;
+    std::uint64_t counter_hi = 0;
+    std::array<std::uint32_t, 4> block = {};
+    int index = 4;
+
+    void advance(std::uint64_t blocks) {
+        auto old = counter_lo;
+        counter_lo += blocks;
+        if (counter_lo < old) {
+            ++counter_hi;
+        }
+    }
+
+    void refill() {
+        constexpr std::uint32_t M0 = 0xD2511F53;
+        constexpr std::uint32_t M1 = 0xCD9E8D57;
+        constexpr std::uint32_t W0 = 0x9E3779B9;
+        constexpr std::uint32_t W1 = 0xBB67AE85;
+
+        std::uint32_t c0 = std::uint32_t(counter_lo);
+        std::uint32_t c1 = std::uint32_t(counter_lo >> 32);
+        std::uint32_t c2 = std::uint32_t(counter_hi);
+        std::uint32_t c3 = std::uint32_t(counter_hi >> 32);
+        std::uint32_t k0 = std::uint32_t(key);
+        std::uint32_t k1 = std::uint32_t(key >> 32);
+
+        for (int round=0; round<10; ++round) {
+            auto p0 = std::uint64_t(M0) * c0;
+            auto p1 = std::uint64_t(M1) * c2;
+            auto n0 = std::uint32_t(p1 >> 32) ^ c1 ^ k0;
+            auto n2 = std::uint32_t(p0 >> 32) ^ c3 ^ k1;
+            c1 = std::uint32_t(p1);
+            c3 = std::uint32_t(p0);
+            c0 = n0;
+            c2 = n2;
+            k0 += W0;
+            k1 += W1;
+        }
+
+        block = {{c0, c1, c2, c3}};
+        index = 0;
+        advance(1);
+    }
+};
+
+// Walker/Vose alias table: O(1) sampling of a fixed discrete distribution with two draws,
+// built once instead of constructing a std::discrete_distribution per call.
+template <std::size_t N>
+class AliasTable {
+public:
+    explicit AliasTable(const double (&weights)[N]) {
+        auto total = 0.0;
+        for (auto w : weights) {
+            total += w;
+        }
+
+        auto scaled = std::array<double, N>();
+        auto small = std::vector<int>();
+        auto large = std::vector<int>();
+        for (std::size_t i=0; i<N; ++i) {
+            scaled[i] = weights[i] * N / total;
+            (scaled[i] < 1.0 ? small : large).push_back(int(i));
+        }
+
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back();
+            auto l = large.back();
+            small.pop_back();
+            large.pop_back();
+            threshold[s] = to_threshold(scaled[s]);
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            (scaled[l] < 1.0 ? small : large).push_back(l);
+        }
+        // Leftovers are 1.0 up to rounding error.
+        for (auto i : small) {
+            threshold[i] = full();
+            alias[i] = i;
+        }
+        for (auto i : large) {
+            threshold[i] = full();
+            alias[i] = i;
+        }
+    }
+
+    template <typename G>
+    int operator()(G& g) const {
+        static_assert(G::min() == 0 && G::max() == 0xFFFFFFFF, "AliasTable needs a full 32-bit generator!");
+        auto column = int((std::uint64_t(g()) * N) >> 32);
+        return std::uint64_t(g()) < threshold[column] ? column : alias[column];
+    }
+
+private:
+    static constexpr std::uint64_t full() { return 1ull << 32; }
+
+    static std::uint64_t to_threshold(double p) {
+        return p >= 1.0 ? full() : std::uint64_t(p * double(full()));
+    }
+
+    std::array<std::uint64_t, N> threshold;
+    std::array<int, N> alias;
+};
+
+#endif //LD34_RANDOM_HPP
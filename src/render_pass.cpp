@@ -0,0 +1,102 @@
+#include "render_pass.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+constexpr int GpuTimer::NUM_QUERIES;
+
+namespace {
+
+std::string read_shader_source(const std::string& fname) {
+    auto file = std::ifstream(fname);
+    if (!file) {
+        throw std::runtime_error("Failed to open shader " + fname + "!");
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// GLSL wants #version before anything else, so the defines go right after it,
+// followed by a #line so that compile errors still point at the right line of the file.
+sushi::unique_shader compile_shader_variant(sushi::shader_type type, const std::string& fname, unsigned features) {
+    auto source = read_shader_source(fname);
+    auto body = std::size_t(0);
+    auto version_line = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        body = source.find('\n');
+        body = body == std::string::npos ? source.size() : body + 1;
+        version_line = 1;
+    }
+    auto version = source.substr(0, body);
+
+    auto defines = std::string();
+    if (features & SHADER_LIGHTING) {
+        defines += "#define LIGHTING\n";
+    }
+    if (features & SHADER_FISHEYE) {
+        defines += "#define FISHEYE\n";
+    }
+    defines += "#line " + std::to_string(version_line + 1) + "\n";
+
+    return sushi::compile_shader(type, {version.c_str(), defines.c_str(), source.c_str() + body});
+}
+
+}
+
+sushi::unique_program load_shader_variant(unsigned features) {
+    return sushi::link_program({
+        compile_shader_variant(sushi::shader_type::VERTEX, "assets/shaders/vertex.glsl", features),
+        compile_shader_variant(sushi::shader_type::FRAGMENT, "assets/shaders/fragment.glsl", features)
+    });
+}
+
+GpuTimer::GpuTimer() {
+    glGenQueries(NUM_QUERIES, queries);
+}
+
+GpuTimer::GpuTimer(GpuTimer&& other) noexcept : next(other.next), running(other.running), last(other.last) {
+    for (int i=0; i<NUM_QUERIES; ++i) {
+        queries[i] = other.queries[i];
+        pending[i] = other.pending[i];
+        other.queries[i] = 0;
+        other.pending[i] = false;
+    }
+    other.running = false;
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(NUM_QUERIES, queries);
+}
+
+void GpuTimer::begin(const RenderState& render_state) {
+    if (!render_state.submitting()) {
+        return;
+    }
+    auto query = queries[next];
+    if (pending[next]) {
+        // Reading a result the GPU hasn't got to yet would wait for it. The query stays in flight instead,
+        // this span goes untimed, and last keeps the result before.
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return;
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        last = ns / 1e6;
+        pending[next] = false;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    running = true;
+}
+
+void GpuTimer::end() {
+    if (!running) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[next] = true;
+    next = (next + 1) % NUM_QUERIES;
+    running = false;
+}
@@ -0,0 +1,95 @@
+#ifndef LD34_RENDER_PASS_HPP
+#define LD34_RENDER_PASS_HPP
+
+#include "lighting.hpp"
+#include "render_state.hpp"
+
+#include <sushi/sushi.hpp>
+
+// Features the shaders are specialized on. Each one is a #define in assets/shaders/*.glsl,
+// so a variant only contains the code and uniforms it actually uses.
+enum ShaderFeature : unsigned {
+    SHADER_LIGHTING = 1 << 0, // Lamp and clustered lights; without it everything is full bright
+    SHADER_FISHEYE = 1 << 1,  // Samples through the fisheye warp, for the final blit
+};
+
+// Compiles the vertex and fragment shaders with a #define for each feature in the mask.
+sushi::unique_program load_shader_variant(unsigned features);
+
+// One compiled variant and the uniforms it has. Binding a pass selects its program;
+// the setters for uniforms a variant does not have fail to compile instead of silently doing nothing.
+template <unsigned Features>
+class ShaderPass {
+public:
+    ShaderPass() : program(load_shader_variant(Features)) {}
+
+    // Sampler units never change, so after the first bind these are all elided by the cache.
+    void bind(RenderState& render_state) const {
+        render_state.set_program(program);
+        render_state.set_uniform("Texture", 0);
+        if (Features & SHADER_LIGHTING) {
+            render_state.set_uniform("LightData", LightClusters::FIRST_UNIT);
+            render_state.set_uniform("LightGrid", LightClusters::FIRST_UNIT + 1);
+            render_state.set_uniform("LightIndices", LightClusters::FIRST_UNIT + 2);
+        }
+        if (Features & SHADER_FISHEYE) {
+            render_state.set_uniform("FisheyeTheta", glm::radians(120.f));
+        }
+    }
+
+    // The model and view matrices only matter for lighting; unlit variants just take the MVP.
+    void set_transform(RenderState& render_state, const glm::mat4& mvp, const glm::mat4& model_mat, const glm::mat4& view_mat) const {
+        render_state.set_uniform("MVP", mvp);
+        if (Features & SHADER_LIGHTING) {
+            render_state.set_uniform("ModelMat", model_mat);
+            render_state.set_uniform("ViewMat", view_mat);
+        }
+    }
+
+    void set_lamp(RenderState& render_state, float bright_radius, float dim_radius) const {
+        static_assert(Features & SHADER_LIGHTING, "Only lit passes have a lamp!");
+        render_state.set_uniform("BrightRadius", bright_radius);
+        render_state.set_uniform("DimRadius", dim_radius);
+    }
+
+    void set_clusters(RenderState& render_state, const glm::vec4& params) const {
+        static_assert(Features & SHADER_LIGHTING, "Only lit passes have light clusters!");
+        render_state.set_uniform("ClusterParams", params);
+    }
+
+private:
+    sushi::unique_program program;
+};
+
+using LitPass = ShaderPass<SHADER_LIGHTING>;
+using FlatPass = ShaderPass<0>;
+using FisheyePass = ShaderPass<SHADER_FISHEYE>;
+
+// GL_TIME_ELAPSED around a span of GL work. Each begin/end uses the next of a few queries in turn,
+// and a query's result is only read when it comes round again and is available, so asking never stalls
+// the pipeline. While the GPU is that far behind, spans go untimed.
+class GpuTimer {
+public:
+    GpuTimer();
+    GpuTimer(GpuTimer&& other) noexcept;
+    GpuTimer& operator=(GpuTimer&&) = delete;
+    ~GpuTimer();
+
+    // Nothing is timed while render_state is not submitting.
+    void begin(const RenderState& render_state);
+    void end();
+
+    // The most recent result, a few frames old; 0 until there is one.
+    double last_ms() const { return last; }
+
+private:
+    static constexpr int NUM_QUERIES = 4;
+
+    GLuint queries[NUM_QUERIES] = {};
+    bool pending[NUM_QUERIES] = {};
+    int next = 0;
+    bool running = false;
+    double last = 0.0;
+};
+
+#endif //LD34_RENDER_PASS_HPP
@@ -0,0 +1,195 @@
+#include "render_state.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+RenderState::FrameStats& RenderState::FrameStats::operator+=(const FrameStats& other) {
+    auto add = [](Counter& a, const Counter& b) {
+        a.issued += b.issued;
+        a.elided += b.elided;
+    };
+    add(framebuffers, other.framebuffers);
+    add(programs, other.programs);
+    add(textures, other.textures);
+    add(uniforms, other.uniforms);
+    add(clears, other.clears);
+    draws += other.draws;
+    return *this;
+}
+
+constexpr GLuint RenderState::UNKNOWN;
+constexpr GLint RenderState::UNKNOWN_LOCATION;
+
+void RenderState::begin_frame() {
+    flush_clear();
+    last = cur;
+    total += cur;
+    cur = {};
+    clean[0] = 0;
+}
+
+void RenderState::invalidate() {
+    flush_clear();
+    cur_program = UNKNOWN;
+    cur_framebuffer = UNKNOWN;
+    viewport = {-1, -1};
+    textures = make_unknown_textures();
+    buffer_textures = make_unknown_textures();
+    uniforms.clear();
+    cur_uniforms = nullptr;
+    clear_color = {-1.f, -1.f, -1.f, -1.f};
+    clean.clear();
+}
+
+void RenderState::set_submit(bool enabled) {
+    if (enabled == submit) {
+        return;
+    }
+    // Any pending clear goes out, or not, under the setting it was made with.
+    invalidate();
+    submit = enabled;
+}
+
+void RenderState::bind_framebuffer(GLuint fbo, int width, int height) {
+    if (fbo == cur_framebuffer && viewport.x == width && viewport.y == height) {
+        ++cur.framebuffers.elided;
+        return;
+    }
+    flush_clear();
+    if (submit) {
+        if (fbo != cur_framebuffer) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        }
+        glViewport(0, 0, width, height);
+    }
+    cur_framebuffer = fbo;
+    viewport = {width, height};
+    ++cur.framebuffers.issued;
+}
+
+void RenderState::set_clear_color(const glm::vec4& color) {
+    if (color == clear_color) {
+        return;
+    }
+    flush_clear();
+    if (submit) {
+        glClearColor(color.x, color.y, color.z, color.w);
+    }
+    clear_color = color;
+    for (auto& c : clean) {
+        c.second &= ~GL_COLOR_BUFFER_BIT;
+    }
+}
+
+void RenderState::clear(GLbitfield mask) {
+    auto bits = mask & ~clean[cur_framebuffer];
+    if (bits == 0 || pending_clear != 0) {
+        ++cur.clears.elided;
+    }
+    pending_clear |= bits;
+}
+
+void RenderState::flush_clear() {
+    if (pending_clear == 0) {
+        return;
+    }
+    if (submit) {
+        glClear(pending_clear);
+    }
+    clean[cur_framebuffer] |= pending_clear;
+    pending_clear = 0;
+    ++cur.clears.issued;
+}
+
+void RenderState::set_program(const sushi::unique_program& prog) {
+    if (prog.get() == cur_program) {
+        ++cur.programs.elided;
+        return;
+    }
+    if (submit) {
+        sushi::set_program(prog);
+    }
+    cur_program = prog.get();
+    cur_uniforms = &uniforms[cur_program];
+    ++cur.programs.issued;
+}
+
+void RenderState::set_texture(int slot, const sushi::texture_2d& texture) {
+    auto handle = texture.handle.get();
+    if (textures[slot] == handle) {
+        ++cur.textures.elided;
+        return;
+    }
+    if (submit) {
+        sushi::set_texture(slot, texture);
+    }
+    textures[slot] = handle;
+    ++cur.textures.issued;
+}
+
+void RenderState::set_texture_buffer(int slot, GLuint texture) {
+    if (buffer_textures[slot] == texture) {
+        ++cur.textures.elided;
+        return;
+    }
+    if (submit) {
+        glActiveTexture(GL_TEXTURE0 + slot);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        // sushi::set_texture and the texture uploads elsewhere assume unit 0 is active.
+        glActiveTexture(GL_TEXTURE0);
+    }
+    buffer_textures[slot] = texture;
+    ++cur.textures.issued;
+}
+
+void RenderState::draw_mesh(const sushi::static_mesh& mesh) {
+    flush_clear();
+    if (submit) {
+        sushi::draw_mesh(mesh);
+    }
+    clean[cur_framebuffer] = 0;
+    ++cur.draws;
+}
+
+void RenderState::draw_mesh(const IndexedMesh& mesh) {
+    flush_clear();
+    if (submit) {
+        mesh.draw();
+    }
+    clean[cur_framebuffer] = 0;
+    ++cur.draws;
+}
+
+RenderState::Uniform& RenderState::find_uniform(const char* name) {
+    auto& program_uniforms = *cur_uniforms;
+    auto iter = program_uniforms.by_address.find(name);
+    if (iter != program_uniforms.by_address.end()) {
+        return *iter->second;
+    }
+    auto& uniform = program_uniforms.by_name[name];
+    program_uniforms.by_address[name] = &uniform;
+    return uniform;
+}
+
+void RenderState::upload_uniform(GLint location, int value) {
+    glUniform1i(location, value);
+}
+
+void RenderState::upload_uniform(GLint location, float value) {
+    glUniform1f(location, value);
+}
+
+void RenderState::upload_uniform(GLint location, const glm::vec2& value) {
+    glUniform2fv(location, 1, glm::value_ptr(value));
+}
+
+void RenderState::upload_uniform(GLint location, const glm::vec3& value) {
+    glUniform3fv(location, 1, glm::value_ptr(value));
+}
+
+void RenderState::upload_uniform(GLint location, const glm::vec4& value) {
+    glUniform4fv(location, 1, glm::value_ptr(value));
+}
+
+void RenderState::upload_uniform(GLint location, const glm::mat4& value) {
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+}
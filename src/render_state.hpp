@@ -0,0 +1,135 @@
+#ifndef LD34_RENDER_STATE_HPP
+#define LD34_RENDER_STATE_HPP
+
+#include "mesh.hpp"
+
+#include <sushi/sushi.hpp>
+
+#include <array>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+// Thin wrapper over the sushi/GL calls the game makes every frame.
+// Remembers what is currently bound so that no-op changes never reach the driver,
+// and defers clears until the next draw so back-to-back clears collapse into one.
+class RenderState {
+public:
+    struct Counter {
+        int issued = 0;
+        int elided = 0;
+    };
+
+    struct FrameStats {
+        Counter framebuffers;
+        Counter programs;
+        Counter textures;
+        Counter uniforms;
+        Counter clears;
+        int draws = 0;
+
+        FrameStats& operator+=(const FrameStats& other);
+    };
+
+    // Publishes the counters of the frame that just ended and starts counting a new one.
+    // The default framebuffer is undefined after a swap, so it is no longer considered clean.
+    void begin_frame();
+
+    // Forget everything; call after touching GL state behind our back.
+    void invalidate();
+
+    // With submission off, state is still tracked and counted but nothing reaches GL.
+    // Headless replays use this to run the game without drawing. Changing it invalidates,
+    // since what was tracked with submission off never reached GL.
+    void set_submit(bool enabled);
+    bool submitting() const { return submit; }
+
+    const FrameStats& last_frame() const { return last; }
+    const FrameStats& totals() const { return total; }
+
+    void bind_framebuffer(GLuint fbo, int width, int height);
+    void set_clear_color(const glm::vec4& color);
+    void clear(GLbitfield mask);
+
+    void set_program(const sushi::unique_program& program);
+    void set_texture(int slot, const sushi::texture_2d& texture);
+    void set_texture_buffer(int slot, GLuint texture);
+    void draw_mesh(const sushi::static_mesh& mesh);
+    void draw_mesh(const IndexedMesh& mesh);
+
+    // Uniforms are looked up by the address of their name, so name should be a string literal;
+    // the location is only asked of GL the first time a program sees a name.
+    template <typename T>
+    void set_uniform(const char* name, const T& value) {
+        static_assert(sizeof(T) <= sizeof(Uniform::data), "Uniform type too large to cache!");
+        auto& cached = find_uniform(name);
+        if (cached.size == sizeof(T) && std::memcmp(cached.data.data(), &value, sizeof(T)) == 0) {
+            ++cur.uniforms.elided;
+            return;
+        }
+        cached.size = sizeof(T);
+        std::memcpy(cached.data.data(), &value, sizeof(T));
+        if (submit) {
+            if (cached.location == UNKNOWN_LOCATION) {
+                cached.location = glGetUniformLocation(cur_program, name);
+            }
+            upload_uniform(cached.location, value);
+        }
+        ++cur.uniforms.issued;
+    }
+
+private:
+    static constexpr GLuint UNKNOWN = ~GLuint(0);
+
+    static constexpr GLint UNKNOWN_LOCATION = -2;
+
+    struct Uniform {
+        std::array<unsigned char, sizeof(glm::mat4)> data;
+        std::size_t size = 0;
+        GLint location = UNKNOWN_LOCATION;
+    };
+
+    // Two literals with the same text may have different addresses, so a new address
+    // falls back to the name itself before it gets a slot of its own.
+    struct ProgramUniforms {
+        std::unordered_map<const char*, Uniform*> by_address;
+        std::unordered_map<std::string, Uniform> by_name;
+    };
+
+    Uniform& find_uniform(const char* name);
+    static void upload_uniform(GLint location, int value);
+    static void upload_uniform(GLint location, float value);
+    static void upload_uniform(GLint location, const glm::vec2& value);
+    static void upload_uniform(GLint location, const glm::vec3& value);
+    static void upload_uniform(GLint location, const glm::vec4& value);
+    static void upload_uniform(GLint location, const glm::mat4& value);
+
+    void flush_clear();
+
+    bool submit = true;
+
+    GLuint cur_program = UNKNOWN;
+    GLuint cur_framebuffer = UNKNOWN;
+    glm::ivec2 viewport = {-1, -1};
+    std::array<GLuint, 16> textures = make_unknown_textures();
+    std::array<GLuint, 16> buffer_textures = make_unknown_textures();
+    std::unordered_map<GLuint, ProgramUniforms> uniforms;
+    ProgramUniforms* cur_uniforms = nullptr;
+
+    glm::vec4 clear_color = {-1.f, -1.f, -1.f, -1.f};
+    GLbitfield pending_clear = 0;
+    // Buffers of each framebuffer that have been cleared and not drawn to since.
+    std::unordered_map<GLuint, GLbitfield> clean;
+
+    FrameStats cur;
+    FrameStats last;
+    FrameStats total;
+
+    static std::array<GLuint, 16> make_unknown_textures() {
+        auto rv = std::array<GLuint, 16>();
+        rv.fill(UNKNOWN);
+        return rv;
+    }
+};
+
+#endif //LD34_RENDER_STATE_HPP
@@ -0,0 +1,58 @@
+#include "settings.hpp"
+
+#include <json/json.h>
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+static constexpr int SETTINGS_VERSION = 1;
+
+bool load_quality_settings(const std::string& fname, QualitySettings& out) {
+    auto file = std::ifstream(fname);
+    if (!file) {
+        return false;
+    }
+
+    auto root = Json::Value();
+    auto builder = Json::CharReaderBuilder();
+    auto errors = std::string();
+    if (!Json::parseFromStream(builder, file, &root, &errors) || !root.isObject()) {
+        return false;
+    }
+    if (root.get("version", 0).asInt() != SETTINGS_VERSION) {
+        return false;
+    }
+
+    auto rv = QualitySettings();
+    rv.renderer = root.get("renderer", "").asString();
+    rv.AA = root.get("AA", rv.AA).asInt();
+    rv.anisotropic = root.get("anisotropic", rv.anisotropic).asBool();
+    rv.lookahead = root.get("lookahead", rv.lookahead).asInt();
+    rv.frame_ms = root.get("frame_ms", rv.frame_ms).asDouble();
+    if (rv.AA < 1 || rv.lookahead < 0) {
+        return false;
+    }
+
+    out = rv;
+    return true;
+}
+
+void save_quality_settings(const std::string& fname, const QualitySettings& settings) {
+    auto root = Json::Value(Json::objectValue);
+    root["version"] = SETTINGS_VERSION;
+    root["renderer"] = settings.renderer;
+    root["AA"] = settings.AA;
+    root["anisotropic"] = settings.anisotropic;
+    root["lookahead"] = settings.lookahead;
+    root["frame_ms"] = settings.frame_ms;
+
+    auto file = std::ofstream(fname);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + fname + " for writing!");
+    }
+    auto builder = Json::StreamWriterBuilder();
+    auto writer = std::unique_ptr<Json::StreamWriter>(builder.newStreamWriter());
+    writer->write(root, &file);
+    file << std::endl;
+}
@@ -0,0 +1,20 @@
+#ifndef LD34_SETTINGS_HPP
+#define LD34_SETTINGS_HPP
+
+#include <string>
+
+// Quality settings picked by the startup benchmark, kept next to the renderer they were measured on.
+struct QualitySettings {
+    std::string renderer;
+    int AA = 2;
+    bool anisotropic = true;
+    int lookahead = 4;
+    double frame_ms = 0.0; // What the benchmark measured for this choice
+};
+
+// False if the file is missing, unreadable or from another version; out is left alone then.
+bool load_quality_settings(const std::string& fname, QualitySettings& out);
+
+void save_quality_settings(const std::string& fname, const QualitySettings& settings);
+
+#endif //LD34_SETTINGS_HPP